@@ -0,0 +1,347 @@
+#include "kernel.hpp"
+#include "matrix.hpp"
+#include "vector.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <cstdint>
+#include <stdio.h>
+
+// Standalone micro-benchmarks for the Vector/Matrix kernels. Row kernels
+// pick their rows at random from matrices sized to each working set, as
+// negative sampling does; the cost of drawing an index (one xorshift and one
+// multiply) is included in every measurement. The table goes to stderr so
+// that -json - can be piped.
+
+struct WorkingSet {
+    const char* name;
+    size_t bytes;
+};
+
+struct Result {
+    std::string kernel;
+    int dim;
+    std::string workingSet;
+    size_t workingSetBytes;
+    double nsPerOp;
+    double gbPerSec;
+};
+
+struct BenchOptions {
+    std::string isa;
+    std::string precision;
+    std::string json;
+    double minTime;
+    size_t maxWorkingSet;
+};
+
+const int Dims[] = {100, 128, 200, 256, 300, 384, 600, 768, 900};
+const int BlockSizes[] = {4, 16, 64, 256};
+
+volatile float sink;
+
+inline uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+inline int randomRow(uint32_t& state, int rows) {
+    return (int)(((uint64_t)nextRandom(state) * (uint64_t)rows) >> 32);
+}
+
+// Runs body(ops) with a doubling op count until it takes at least minTime
+// seconds and returns the time per op in nanoseconds.
+template <class Body>
+double measure(double minTime, Body body) {
+    long ops = 1024;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        body(ops);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed >= minTime) {
+            return elapsed * 1e9 / ops;
+        }
+        ops *= elapsed > 0.0 ? std::min(std::max(2.0, 1.2 * minTime / elapsed), 64.0) : 64.0;
+    }
+}
+
+void printUsage() {
+    sv4d::kernel::Isa isa = sv4d::kernel::detectIsa();
+    std::cerr
+        << "usage: sv4d_bench <options>\n\n"
+        << "The following arguments are optional:\n"
+        << "  -isa                      scalar, sse, avx2 or avx512 [" << sv4d::kernel::isaName(isa) << "]\n"
+        << "  -precision                row storage: fp32, bf16 or fp16 [fp32]\n"
+        << "  -json                     write results as JSON to this file, - for stdout []\n"
+        << "  -min_time                 minimum seconds per measurement [0.1]\n"
+        << "  -max_working_set          largest working set in MB [256]\n"
+        << std::endl;
+}
+
+BenchOptions parseOptions(const std::vector<std::string>& args) {
+    BenchOptions opt;
+    opt.isa = sv4d::kernel::isaName(sv4d::kernel::detectIsa());
+    opt.precision = "fp32";
+    opt.json = "";
+    opt.minTime = 0.1;
+    opt.maxWorkingSet = 256;
+    for (size_t i = 1; i < args.size(); i += 2) {
+        if (args[i] == "-h" || args[i] == "--help") {
+            throw std::runtime_error("help");
+        }
+        try {
+            if (args[i] == "-isa") {
+                opt.isa = args.at(i + 1);
+            } else if (args[i] == "-precision") {
+                opt.precision = args.at(i + 1);
+            } else if (args[i] == "-json") {
+                opt.json = args.at(i + 1);
+            } else if (args[i] == "-min_time") {
+                opt.minTime = std::stod(args.at(i + 1));
+            } else if (args[i] == "-max_working_set") {
+                opt.maxWorkingSet = std::stoul(args.at(i + 1));
+            } else {
+                throw std::runtime_error("Unknown argument: " + args[i]);
+            }
+        } catch (const std::out_of_range&) {
+            throw std::runtime_error(args[i] + " is missing an argument");
+        }
+    }
+    return opt;
+}
+
+sv4d::kernel::Isa parseIsa(const std::string& name) {
+    for (int isa = sv4d::kernel::Isa::Scalar; isa <= sv4d::kernel::Isa::Avx512; ++isa) {
+        if (name == sv4d::kernel::isaName((sv4d::kernel::Isa)isa)) {
+            if (isa > sv4d::kernel::detectIsa()) {
+                throw std::runtime_error("This CPU does not support " + name);
+            }
+            return (sv4d::kernel::Isa)isa;
+        }
+    }
+    throw std::runtime_error("Unknown isa: " + name);
+}
+
+void report(std::vector<Result>& results, const std::string& kernel, int dim, const WorkingSet& workingSet, double nsPerOp, double bytesPerOp) {
+    Result result = {kernel, dim, workingSet.name, workingSet.bytes, nsPerOp, bytesPerOp / nsPerOp};
+    fprintf(stderr, "%-18s %5d %6s %12.2f ns/op %10.2f GB/s\n", kernel.c_str(), dim, workingSet.name, result.nsPerOp, result.gbPerSec);
+    results.push_back(result);
+}
+
+void benchRowKernels(const BenchOptions& opt, sv4d::kernel::Precision precision, const std::vector<WorkingSet>& workingSets, std::vector<Result>& results) {
+    for (int dim : Dims) {
+        sv4d::Vector vector = sv4d::Vector(dim);
+        vector.setRandomUniform(-0.5f / dim, 0.5f / dim);
+        for (auto& workingSet : workingSets) {
+            int rows = std::max(1, (int)(workingSet.bytes / sv4d::Matrix::bytes(1, dim, precision)));
+            sv4d::Matrix matrix = sv4d::Matrix(rows, dim, precision);
+            matrix.setRandomUniform(-0.5f / dim, 0.5f / dim);
+            double rowBytes = (double)dim * sv4d::kernel::precisionSize(precision);
+
+            // operator%: one row read
+            double ns = measure(opt.minTime, [&](long ops) {
+                uint32_t state = 495;
+                float sum = 0.0f;
+                for (long k = 0; k < ops; ++k) {
+                    sum += vector % matrix[randomRow(state, rows)];
+                }
+                sink = sum;
+            });
+            report(results, "dot", dim, workingSet, ns, rowBytes);
+
+            // fusedMultiplyAdd into a row: one row read and written
+            ns = measure(opt.minTime, [&](long ops) {
+                uint32_t state = 495;
+                for (long k = 0; k < ops; ++k) {
+                    matrix[randomRow(state, rows)].fusedMultiplyAdd(vector, 1e-6f);
+                }
+            });
+            report(results, "fused_multiply_add", dim, workingSet, ns, 2.0 * rowBytes);
+
+            // dot followed by an update of the same row, as in one negative sample
+            ns = measure(opt.minTime, [&](long ops) {
+                uint32_t state = 495;
+                for (long k = 0; k < ops; ++k) {
+                    sv4d::VectorView row = matrix[randomRow(state, rows)];
+                    float g = sv4d::utils::operation::sigmoid(vector % row) * 1e-6f;
+                    row.fusedMultiplyAdd(vector, g);
+                }
+            });
+            report(results, "negative_sample", dim, workingSet, ns, 2.0 * rowBytes);
+        }
+    }
+
+    // setRandomUniform over a whole L3-sized matrix, reported per row
+    for (int dim : Dims) {
+        const WorkingSet& workingSet = workingSets[2];
+        int rows = std::max(1, (int)(workingSet.bytes / sv4d::Matrix::bytes(1, dim, precision)));
+        sv4d::Matrix matrix = sv4d::Matrix(rows, dim, precision);
+        long fills = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0.0;
+        while (elapsed < opt.minTime) {
+            matrix.setRandomUniform(-0.5f / dim, 0.5f / dim);
+            fills += 1;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        report(results, "set_random_uniform", dim, workingSet, elapsed * 1e9 / (fills * rows), (double)dim * sv4d::kernel::precisionSize(precision));
+    }
+}
+
+void benchBlockKernels(const BenchOptions& opt, std::vector<Result>& results) {
+    WorkingSet l1 = {"L1", 0};
+    for (int n : BlockSizes) {
+        sv4d::Vector x = sv4d::Vector(n);
+        sv4d::Vector y = sv4d::Vector(n);
+        sv4d::Vector z = sv4d::Vector(n);
+        x.setRandomUniform(-8.0f, 8.0f);
+        l1.bytes = 3 * sizeof(float) * n;
+
+        double ns = measure(opt.minTime, [&](long ops) {
+            for (long k = 0; k < ops; ++k) {
+                x.softmax(0.5f, y, z);
+            }
+            sink = y[0] + z[0];
+        });
+        report(results, "softmax", n, l1, ns, 3.0 * sizeof(float) * n);
+
+        ns = measure(opt.minTime, [&](long ops) {
+            for (long k = 0; k < ops; ++k) {
+                sv4d::kernel::sigmoid(x.data, y.data, n);
+            }
+            sink = y[0];
+        });
+        report(results, "sigmoid", n, l1, ns, 2.0 * sizeof(float) * n);
+
+        ns = measure(opt.minTime, [&](long ops) {
+            float sum = 0.0f;
+            for (long k = 0; k < ops; ++k) {
+                for (int i = 0; i < n; ++i) {
+                    sum += sv4d::utils::operation::sigmoid(x[i]);
+                }
+            }
+            sink = sum;
+        });
+        report(results, "sigmoid_table", n, l1, ns, 1.0 * sizeof(float) * n);
+    }
+}
+
+// Products of the blocks the training loop builds: GemmRows positions or
+// senses against GemmColumns sense or output rows, all of them in cache.
+const int GemmRows = 8;
+const int GemmColumns = 8;
+
+void benchGemmKernels(const BenchOptions& opt, std::vector<Result>& results) {
+    const int m = GemmRows;
+    const int n = GemmColumns;
+    for (int dim : Dims) {
+        sv4d::Matrix a = sv4d::Matrix(m, dim);
+        sv4d::Matrix b = sv4d::Matrix(n, dim);
+        sv4d::Matrix scores = sv4d::Matrix(m, n);
+        sv4d::Matrix gradA = sv4d::Matrix(m, dim);
+        sv4d::Matrix gradB = sv4d::Matrix(n, dim);
+        a.setRandomUniform(-0.5f / dim, 0.5f / dim);
+        b.setRandomUniform(-0.5f / dim, 0.5f / dim);
+        scores.setRandomUniform(-1e-3f, 1e-3f);
+        gradA.setZero();
+        gradB.setZero();
+        size_t bytes = sizeof(float) * ((size_t)(m + n) * dim + m * n);
+        WorkingSet workingSet = {bytes <= (32 << 10) ? "L1" : "L2", bytes};
+
+        double ns = measure(opt.minTime, [&](long ops) {
+            for (long k = 0; k < ops; ++k) {
+                sv4d::kernel::gemmNT(m, n, dim, (const float*)a.data, a.stride, (const float*)b.data, b.stride, (float*)scores.data, scores.stride);
+            }
+            sink = *(float*)scores.data;
+        });
+        report(results, "gemm_nt", dim, workingSet, ns, (double)bytes);
+
+        // the scores are left untouched, so the gradients only grow
+        ns = measure(opt.minTime, [&](long ops) {
+            for (long k = 0; k < ops; ++k) {
+                sv4d::kernel::gemmNN(m, n, dim, (const float*)scores.data, scores.stride, (const float*)b.data, b.stride, (float*)gradA.data, gradA.stride);
+            }
+            sink = *(float*)gradA.data;
+        });
+        report(results, "gemm_nn", dim, workingSet, ns, (double)bytes + sizeof(float) * m * dim);
+
+        ns = measure(opt.minTime, [&](long ops) {
+            for (long k = 0; k < ops; ++k) {
+                sv4d::kernel::gemmTN(m, n, dim, (const float*)scores.data, scores.stride, (const float*)a.data, a.stride, (float*)gradB.data, gradB.stride);
+            }
+            sink = *(float*)gradB.data;
+        });
+        report(results, "gemm_tn", dim, workingSet, ns, (double)bytes + sizeof(float) * n * dim);
+    }
+}
+
+void writeJson(std::ostream& out, const BenchOptions& opt, const std::vector<Result>& results) {
+    out << "{\n";
+    out << "  \"isa\": \"" << opt.isa << "\",\n";
+    out << "  \"precision\": \"" << opt.precision << "\",\n";
+    out << "  \"min_time\": " << opt.minTime << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        out << "    {\"kernel\": \"" << result.kernel << "\", \"dim\": " << result.dim
+            << ", \"working_set\": \"" << result.workingSet << "\", \"working_set_bytes\": " << result.workingSetBytes
+            << ", \"ns_per_op\": " << result.nsPerOp << ", \"gb_per_s\": " << result.gbPerSec << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv, argv + argc);
+
+    BenchOptions opt;
+    sv4d::kernel::Isa isa;
+    sv4d::kernel::Precision precision;
+    try {
+        opt = parseOptions(args);
+        isa = parseIsa(opt.isa);
+        precision = sv4d::kernel::parsePrecision(opt.precision);
+    } catch (const std::exception& e) {
+        if (e.what() != std::string("help")) {
+            std::cerr << e.what() << '\n';
+        }
+        printUsage();
+        exit(EXIT_FAILURE);
+    }
+
+    sv4d::kernel::initialize(isa);
+    fprintf(stderr, "SIMD: %s  Precision: %s  \n", sv4d::kernel::isaName(isa), sv4d::kernel::precisionName(precision));
+
+    std::vector<WorkingSet> workingSets = {
+        {"L1", 16 << 10},
+        {"L2", 256 << 10},
+        {"L3", 8 << 20},
+        {"DRAM", opt.maxWorkingSet << 20},
+    };
+
+    std::vector<Result> results;
+    benchRowKernels(opt, precision, workingSets, results);
+    benchBlockKernels(opt, results);
+    benchGemmKernels(opt, results);
+
+    if (opt.json == "-") {
+        writeJson(std::cout, opt, results);
+    } else if (!opt.json.empty()) {
+        std::ofstream fout(opt.json);
+        if (fout.fail()) {
+            std::cerr << "Cannot open json file" << '\n';
+            exit(EXIT_FAILURE);
+        }
+        writeJson(fout, opt, results);
+    }
+    return 0;
+}
@@ -0,0 +1,446 @@
+#include "corpus.hpp"
+
+#include "vocab.hpp"
+#include "utils.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace sv4d {
+
+    using sv4d::utils::string::StringView;
+
+    MappedFile::MappedFile(const std::string& filepath) : data(nullptr), size(0) {
+        int fd = open(filepath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + filepath);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat " + filepath);
+        }
+        size = st.st_size;
+        if (size > 0) {
+            void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map " + filepath);
+            }
+            madvise(ptr, size, MADV_SEQUENTIAL);
+            data = (const char*)ptr;
+        }
+        close(fd);
+    }
+
+    MappedFile::~MappedFile() {
+        if (data != nullptr) {
+            munmap((void*)data, size);
+        }
+    }
+
+    WordIndex::WordIndex() : slots(1024, -1) {}
+
+    size_t WordIndex::findSlot(const StringView& word, uint64_t hash) const {
+        size_t mask = slots.size() - 1;
+        size_t slot = hash & mask;
+        while (slots[slot] != -1) {
+            int i = slots[slot];
+            if (hashes[i] == hash && StringView(words[i]) == word) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    int WordIndex::find(const StringView& word) const {
+        int i = slots[findSlot(word, sv4d::utils::string::hash(word))];
+        return i == -1 ? -1 : values[i];
+    }
+
+    int WordIndex::insert(const StringView& word, int value) {
+        uint64_t hash = sv4d::utils::string::hash(word);
+        size_t slot = findSlot(word, hash);
+        if (slots[slot] != -1) {
+            return values[slots[slot]];
+        }
+        slots[slot] = words.size();
+        words.push_back(word.str());
+        values.push_back(value);
+        hashes.push_back(hash);
+        // keep the load factor at most 1/2
+        if (words.size() * 2 > slots.size()) {
+            grow();
+        }
+        return value;
+    }
+
+    void WordIndex::grow() {
+        slots.assign(slots.size() * 2, -1);
+        size_t mask = slots.size() - 1;
+        for (size_t i = 0; i < words.size(); ++i) {
+            size_t slot = hashes[i] & mask;
+            while (slots[slot] != -1) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = i;
+        }
+    }
+
+    // Returns the line starting at position, without its newline, and moves
+    // position past it.
+    inline StringView nextLine(const char*& position, const char* end) {
+        const char* newline = (const char*)std::memchr(position, '\n', end - position);
+        StringView line(position, (newline == nullptr ? end : newline) - position);
+        position = newline == nullptr ? end : newline + 1;
+        return line;
+    }
+
+    const StringView DocumentBeginLine("<doc>", 5);
+    const StringView DocumentEndLine("</doc>", 6);
+
+    CorpusStats countCorpusWords(const std::string& filepath) {
+        CorpusStats stats;
+        stats.sentenceNum = 0;
+        stats.documentNum = 0;
+
+        sv4d::WordIndex wordIndices;
+        std::vector<int> wordCounts;
+
+        sv4d::MappedFile file(filepath);
+        const char* position = file.data;
+        while (position < file.end()) {
+            StringView line = sv4d::utils::string::trim(nextLine(position, file.end()));
+            if (line == DocumentBeginLine) {
+                stats.documentNum += 1;
+                continue;
+            } else if (line == DocumentEndLine) {
+                continue;
+            } else if (line.empty()) {
+                continue;
+            }
+
+            while (!line.empty()) {
+                StringView word = sv4d::utils::string::nextField(line, ' ');
+                int i = wordIndices.insert(word, wordCounts.size());
+                if (i == (int)wordCounts.size()) {
+                    wordCounts.push_back(0);
+                }
+                ++wordCounts[i];
+            }
+
+            stats.sentenceNum += 1;
+            if (stats.sentenceNum % 10000 == 0) {
+                printf("%cReading Line: %ldk  ", 13, stats.sentenceNum / 1000);
+                fflush(stdout);
+            }
+        }
+
+        stats.wordStats.reserve(wordCounts.size());
+        for (size_t i = 0; i < wordCounts.size(); ++i) {
+            stats.wordStats.push_back(std::make_pair(wordIndices.word(i), wordCounts[i]));
+        }
+        // ties keep their first-occurrence order
+        std::stable_sort(stats.wordStats.begin(), stats.wordStats.end(), [](const std::pair<std::string, int> & a, const std::pair<std::string, int> & b) -> bool { return a.second > b.second; });
+        return stats;
+    }
+
+    namespace compiled {
+
+        Header readHeader(const sv4d::MappedFile& file, const std::string& filepath) {
+            Header header;
+            if (file.size < sizeof(Header)) {
+                throw std::runtime_error(filepath + " is not a compiled corpus");
+            }
+            std::memcpy(&header, file.data, sizeof(Header));
+            if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0) {
+                throw std::runtime_error(filepath + " is not a compiled corpus");
+            }
+            if (header.version != Version) {
+                throw std::runtime_error(filepath + " has an unsupported compiled corpus version");
+            }
+            if (header.streamOffset + header.streamLength * (int64_t)sizeof(int32_t) > (int64_t)file.size) {
+                throw std::runtime_error(filepath + " is truncated");
+            }
+            return header;
+        }
+
+    }
+
+    void compileCorpus(const std::string& textFilepath, const std::string& compiledFilepath) {
+        CorpusStats stats = countCorpusWords(textFilepath);
+        printf("\n");
+
+        sv4d::WordIndex wordIndices;
+        for (size_t i = 0; i < stats.wordStats.size(); ++i) {
+            wordIndices.insert(stats.wordStats[i].first, i);
+        }
+
+        sv4d::MappedFile file(textFilepath);
+        std::ofstream fout(compiledFilepath, std::ios::out | std::ios::binary);
+        if (fout.fail()) {
+            throw std::runtime_error("Cannot open compiled corpus file");
+        }
+
+        compiled::Header header;
+        std::memset(&header, 0, sizeof(compiled::Header));
+        std::memcpy(header.magic, compiled::Magic, sizeof(compiled::Magic));
+        header.version = compiled::Version;
+        header.wordNum = stats.wordStats.size();
+        header.sentenceNum = stats.sentenceNum;
+        header.documentNum = stats.documentNum;
+        fout.write((const char*)&header, sizeof(compiled::Header));
+
+        for (auto& pair : stats.wordStats) {
+            int32_t freq = pair.second;
+            int32_t length = pair.first.size();
+            fout.write((const char*)&freq, sizeof(int32_t));
+            fout.write((const char*)&length, sizeof(int32_t));
+            fout.write(pair.first.data(), length);
+        }
+        header.streamOffset = fout.tellp();
+
+        // records are written in blocks of this many
+        const size_t blockSize = 1 << 16;
+        auto records = std::vector<int32_t>();
+        int64_t streamLength = 0;
+        const char* position = file.data;
+        while (position < file.end()) {
+            StringView line = sv4d::utils::string::trim(nextLine(position, file.end()));
+            if (line.empty()) {
+                continue;
+            }
+
+            if (line == DocumentBeginLine) {
+                records.push_back(compiled::BeginOfDocument);
+            } else if (line == DocumentEndLine) {
+                records.push_back(compiled::EndOfDocument);
+            } else {
+                while (!line.empty()) {
+                    records.push_back(wordIndices.find(sv4d::utils::string::nextField(line, ' ')));
+                }
+                records.push_back(compiled::EndOfSentence);
+            }
+
+            if (records.size() >= blockSize) {
+                fout.write((const char*)records.data(), sizeof(int32_t) * records.size());
+                streamLength += records.size();
+                records.clear();
+            }
+        }
+        fout.write((const char*)records.data(), sizeof(int32_t) * records.size());
+        streamLength += records.size();
+
+        header.streamLength = streamLength;
+
+        fout.seekp(0, fout.beg);
+        fout.write((const char*)&header, sizeof(compiled::Header));
+        if (fout.fail()) {
+            throw std::runtime_error("Cannot write compiled corpus file");
+        }
+
+        printf("WordNum: %ld  RecordNum: %ld  SentenceNum: %ld  DocumentNum: %ld  \n", (long)header.wordNum, (long)header.streamLength, (long)header.sentenceNum, (long)header.documentNum);
+    }
+
+    CorpusStats readCompiledCorpusStats(const std::string& filepath) {
+        sv4d::MappedFile file(filepath);
+        compiled::Header header = compiled::readHeader(file, filepath);
+
+        CorpusStats stats;
+        stats.sentenceNum = header.sentenceNum;
+        stats.documentNum = header.documentNum;
+        stats.wordStats.reserve(header.wordNum);
+        const char* position = file.data + sizeof(compiled::Header);
+        for (int64_t i = 0; i < header.wordNum; ++i) {
+            int32_t freq;
+            int32_t length;
+            if (position + 2 * sizeof(int32_t) > file.data + header.streamOffset) {
+                throw std::runtime_error(filepath + " is truncated");
+            }
+            std::memcpy(&freq, position, sizeof(int32_t));
+            std::memcpy(&length, position + sizeof(int32_t), sizeof(int32_t));
+            position += 2 * sizeof(int32_t);
+            if (length < 0 || position + length > file.data + header.streamOffset) {
+                throw std::runtime_error(filepath + " is truncated");
+            }
+            stats.wordStats.push_back(std::make_pair(std::string(position, length), freq));
+            position += length;
+        }
+        return stats;
+    }
+
+    TextCorpusReader::TextCorpusReader(const std::string& filepath, const sv4d::Vocab& vocab) : file(filepath), position(nullptr), end(nullptr) {
+        // only words kept by min_count are looked up
+        for (auto& pair : vocab.synsetVocab) {
+            if (pair.second < vocab.wordVocabSize && vocab.wordFreq[pair.second] != 0) {
+                wordIndices.insert(pair.first, pair.second);
+            }
+        }
+        position = file.data;
+        end = file.data;
+    }
+
+    // Start of the first <doc> line in [target, limit), else of the first
+    // line at or after target.
+    int64_t TextCorpusReader::chunkBoundary(int64_t target, int64_t limit) const {
+        const char* lineStart = file.data + target;
+        if (target > 0 && lineStart[-1] != '\n') {
+            nextLine(lineStart, file.end());
+        }
+        const char* position = lineStart;
+        while (position < file.data + limit) {
+            const char* line = position;
+            if (sv4d::utils::string::trim(nextLine(position, file.end())) == DocumentBeginLine) {
+                return line - file.data;
+            }
+        }
+        return lineStart - file.data;
+    }
+
+    std::vector<sv4d::CorpusChunk> TextCorpusReader::split(int chunkNum) {
+        auto chunks = std::vector<sv4d::CorpusChunk>();
+        int64_t size = file.size;
+        int64_t begin = 0;
+        for (int i = 1; i <= chunkNum; ++i) {
+            int64_t end = i == chunkNum ? size : chunkBoundary(size / chunkNum * i, i + 1 == chunkNum ? size : size / chunkNum * (i + 1));
+            if (end > begin) {
+                chunks.push_back({begin, end});
+                begin = end;
+            }
+        }
+        return chunks;
+    }
+
+    void TextCorpusReader::seek(const sv4d::CorpusChunk& chunk) {
+        position = file.data + chunk.begin;
+        end = file.data + chunk.end;
+    }
+
+    bool TextCorpusReader::finished() {
+        return position >= end;
+    }
+
+    CorpusReader::Line TextCorpusReader::next(std::vector<int>& sentence) {
+        while (position < end) {
+            StringView line = sv4d::utils::string::trim(nextLine(position, end));
+            if (line == DocumentBeginLine) {
+                return Line::DocumentBegin;
+            } else if (line.empty()) {
+                continue;
+            } else if (line == DocumentEndLine) {
+                return Line::DocumentEnd;
+            }
+
+            sentence.clear();
+            while (!line.empty()) {
+                int widx = wordIndices.find(sv4d::utils::string::nextField(line, ' '));
+                if (widx != -1) {
+                    sentence.push_back(widx);
+                }
+            }
+            return Line::Sentence;
+        }
+        return Line::End;
+    }
+
+    CompiledCorpusReader::CompiledCorpusReader(const std::string& filepath, const sv4d::Vocab& vocab) : vocab(vocab), file(filepath), position(nullptr), end(nullptr) {
+        header = compiled::readHeader(file, filepath);
+        stream = file.data + header.streamOffset;
+        position = stream;
+        end = stream;
+    }
+
+    int32_t CompiledCorpusReader::record(int64_t i) const {
+        // the stream is not 4-byte aligned in the file
+        int32_t record;
+        std::memcpy(&record, stream + i * sizeof(int32_t), sizeof(int32_t));
+        return record;
+    }
+
+    // First BeginOfDocument line in [target, limit), else the first line at
+    // or after target. A line starts after any negative record.
+    int64_t CompiledCorpusReader::chunkBoundary(int64_t target, int64_t limit) const {
+        int64_t lineStart = target;
+        while (lineStart < header.streamLength && lineStart > 0 && record(lineStart - 1) >= 0) {
+            ++lineStart;
+        }
+        for (int64_t i = lineStart; i < limit; ++i) {
+            if (record(i) == compiled::BeginOfDocument && (i == 0 || record(i - 1) < 0)) {
+                return i;
+            }
+        }
+        return lineStart;
+    }
+
+    std::vector<sv4d::CorpusChunk> CompiledCorpusReader::split(int chunkNum) {
+        auto chunks = std::vector<sv4d::CorpusChunk>();
+        int64_t length = header.streamLength;
+        int64_t begin = 0;
+        for (int i = 1; i <= chunkNum; ++i) {
+            int64_t end = i == chunkNum ? length : chunkBoundary(length / chunkNum * i, i + 1 == chunkNum ? length : length / chunkNum * (i + 1));
+            if (end > begin) {
+                chunks.push_back({begin, end});
+                begin = end;
+            }
+        }
+        return chunks;
+    }
+
+    void CompiledCorpusReader::seek(const sv4d::CorpusChunk& chunk) {
+        position = stream + chunk.begin * sizeof(int32_t);
+        end = stream + chunk.end * sizeof(int32_t);
+    }
+
+    bool CompiledCorpusReader::finished() {
+        return position >= end;
+    }
+
+    int32_t CompiledCorpusReader::read() {
+        int32_t record;
+        std::memcpy(&record, position, sizeof(int32_t));
+        position += sizeof(int32_t);
+        return record;
+    }
+
+    CorpusReader::Line CompiledCorpusReader::next(std::vector<int>& sentence) {
+        if (position >= end) {
+            return Line::End;
+        }
+        int32_t record = read();
+        if (record == compiled::BeginOfDocument) {
+            return Line::DocumentBegin;
+        } else if (record == compiled::EndOfDocument) {
+            return Line::DocumentEnd;
+        }
+
+        // word indices equal vocab indices for words kept by min_count
+        sentence.clear();
+        while (record != compiled::EndOfSentence) {
+            if (record >= 0 && record < vocab.wordVocabSize && vocab.wordFreq[record] != 0) {
+                sentence.push_back(record);
+            }
+            if (position >= end) {
+                break;
+            }
+            record = read();
+        }
+        return Line::Sentence;
+    }
+
+    std::unique_ptr<sv4d::CorpusReader> openCorpusReader(const std::string& textFilepath, const std::string& compiledFilepath, const sv4d::Vocab& vocab) {
+        if (compiledFilepath != "") {
+            return std::unique_ptr<sv4d::CorpusReader>(new sv4d::CompiledCorpusReader(compiledFilepath, vocab));
+        }
+        return std::unique_ptr<sv4d::CorpusReader>(new sv4d::TextCorpusReader(textFilepath, vocab));
+    }
+
+}
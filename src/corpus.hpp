@@ -0,0 +1,170 @@
+#pragma once
+
+#include "vocab.hpp"
+#include "utils.hpp"
+#include <string>
+#include <vector>
+#include <utility>
+#include <memory>
+#include <deque>
+#include <cstdint>
+
+namespace sv4d {
+
+    // Read-only mapping of a whole file, advised for sequential access.
+    class MappedFile {
+        public:
+            MappedFile(const std::string& filepath);
+            ~MappedFile();
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            const char* data;
+            size_t size;
+
+            const char* end() const { return data + size; }
+    };
+
+    // Open-addressing hash table from words to ints that is queried with
+    // string views, so looking up a token needs no std::string. Inserted
+    // words are copied and keep their insertion order.
+    class WordIndex {
+        public:
+            WordIndex();
+
+            // Value of word, or -1 when absent.
+            int find(const sv4d::utils::string::StringView& word) const;
+            // Adds word with value unless present; returns the stored value.
+            int insert(const sv4d::utils::string::StringView& word, int value);
+
+            int size() const { return words.size(); }
+            const std::string& word(int i) const { return words[i]; }
+
+        private:
+            std::deque<std::string> words;
+            std::vector<int> values;
+            std::vector<uint64_t> hashes;
+            std::vector<int> slots;
+
+            size_t findSlot(const sv4d::utils::string::StringView& word, uint64_t hash) const;
+            void grow();
+    };
+
+    // Word counts of a corpus, sorted by decreasing frequency. Vocab::build
+    // assigns word indices in this order.
+    struct CorpusStats {
+        std::vector<std::pair<std::string, int>> wordStats;
+        long sentenceNum;
+        long documentNum;
+    };
+
+    CorpusStats countCorpusWords(const std::string& filepath);
+
+    // Compiled corpus: the text corpus converted once into int32 records.
+    // Records >= 0 index the word table in the header, which is stored in
+    // CorpusStats order; negative records mark the end of a sentence line
+    // and the <doc> / </doc> lines.
+    namespace compiled {
+
+        const char Magic[8] = {'S', 'V', '4', 'D', 'C', 'O', 'R', 'P'};
+        const int32_t Version = 2;
+
+        const int32_t EndOfSentence = -1;
+        const int32_t BeginOfDocument = -2;
+        const int32_t EndOfDocument = -3;
+
+        struct Header {
+            char magic[8];
+            int32_t version;
+            int32_t reserved;
+            int64_t wordNum;
+            int64_t sentenceNum;
+            int64_t documentNum;
+            int64_t streamOffset;
+            int64_t streamLength;
+        };
+
+        Header readHeader(const sv4d::MappedFile& file, const std::string& filepath);
+
+    }
+
+    void compileCorpus(const std::string& textFilepath, const std::string& compiledFilepath);
+    CorpusStats readCompiledCorpusStats(const std::string& filepath);
+
+    // Half-open range of a corpus, in bytes for text and in records for
+    // compiled corpora, that starts at the head of a line.
+    struct CorpusChunk {
+        int64_t begin;
+        int64_t end;
+    };
+
+    // Reads chunks of the training corpus line by line. Sentence lines come
+    // back as word indices with out-of-vocabulary and zero frequency words
+    // removed.
+    class CorpusReader {
+        public:
+            enum Line {
+                Sentence = 0,
+                DocumentBegin = 1,
+                DocumentEnd = 2,
+                End = 3,
+            };
+
+            virtual ~CorpusReader() {}
+
+            // Cuts the corpus into at most chunkNum consecutive chunks.
+            // Boundaries are moved forward to the next <doc> line within a
+            // chunk's share, else to the next line.
+            virtual std::vector<sv4d::CorpusChunk> split(int chunkNum) = 0;
+            virtual void seek(const sv4d::CorpusChunk& chunk) = 0;
+            // Whether every line of the current chunk has been read.
+            virtual bool finished() = 0;
+            virtual Line next(std::vector<int>& sentence) = 0;
+    };
+
+    // Text corpus read from a mapping of the file; lines and tokens are
+    // scanned in place and looked up by view.
+    class TextCorpusReader : public CorpusReader {
+        public:
+            TextCorpusReader(const std::string& filepath, const sv4d::Vocab& vocab);
+
+            std::vector<sv4d::CorpusChunk> split(int chunkNum);
+            void seek(const sv4d::CorpusChunk& chunk);
+            bool finished();
+            Line next(std::vector<int>& sentence);
+
+        private:
+            sv4d::MappedFile file;
+            sv4d::WordIndex wordIndices;
+            const char* position;
+            const char* end;
+
+            int64_t chunkBoundary(int64_t target, int64_t limit) const;
+    };
+
+    // Compiled corpus read from a mapping of the file.
+    class CompiledCorpusReader : public CorpusReader {
+        public:
+            CompiledCorpusReader(const std::string& filepath, const sv4d::Vocab& vocab);
+
+            std::vector<sv4d::CorpusChunk> split(int chunkNum);
+            void seek(const sv4d::CorpusChunk& chunk);
+            bool finished();
+            Line next(std::vector<int>& sentence);
+
+        private:
+            const sv4d::Vocab& vocab;
+            sv4d::MappedFile file;
+            sv4d::compiled::Header header;
+            const char* stream;
+            const char* position;
+            const char* end;
+
+            int32_t read();
+            int32_t record(int64_t i) const;
+            int64_t chunkBoundary(int64_t target, int64_t limit) const;
+    };
+
+    std::unique_ptr<sv4d::CorpusReader> openCorpusReader(const std::string& textFilepath, const std::string& compiledFilepath, const sv4d::Vocab& vocab);
+
+}
@@ -0,0 +1,1331 @@
+#include "kernel.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SV4D_X86 1
+#include <immintrin.h>
+#endif
+
+namespace sv4d {
+
+    namespace kernel {
+
+        // scalar
+
+        template <int N>
+        float dotScalar(const float* x, const float* y, int size) {
+            const int n = N > 0 ? N : size;
+            float dot = 0.0f;
+            for (int i = 0; i < n; ++i) {
+                dot += x[i] * y[i];
+            }
+            return dot;
+        }
+
+        template <int N>
+        void axpyScalar(float* y, const float* x, float a, int size) {
+            const int n = N > 0 ? N : size;
+            for (int i = 0; i < n; ++i) {
+                y[i] += x[i] * a;
+            }
+        }
+
+        template <int N>
+        void scaleScalar(float* x, float a, int size) {
+            const int n = N > 0 ? N : size;
+            for (int i = 0; i < n; ++i) {
+                x[i] *= a;
+            }
+        }
+
+        int32_t dotInt8Scalar(const int8_t* x, const int8_t* y, int n) {
+            int32_t dot = 0;
+            for (int i = 0; i < n; ++i) {
+                dot += (int32_t)x[i] * y[i];
+            }
+            return dot;
+        }
+
+        // exp(x) for x <= 0 as in Cephes expf: range reduction by ln2 and a
+        // degree 5 polynomial, relative error below 2e-7 over [-87, 0]
+        const float ExpMin = -87.0f;
+        const float ExpLog2e = 1.44269504088896341f;
+        const float ExpC1 = 0.693359375f;
+        const float ExpC2 = -2.12194440e-4f;
+        const float ExpP0 = 1.9875691500e-4f;
+        const float ExpP1 = 1.3981999507e-3f;
+        const float ExpP2 = 8.3334519073e-3f;
+        const float ExpP3 = 4.1665795894e-2f;
+        const float ExpP4 = 1.6666665459e-1f;
+        const float ExpP5 = 5.0000001201e-1f;
+
+        inline float expApprox(float x) {
+            x = std::max(x, ExpMin);
+            float fx = std::floor(x * ExpLog2e + 0.5f);
+            x = x - fx * ExpC1 - fx * ExpC2;
+            float y = ((((ExpP0 * x + ExpP1) * x + ExpP2) * x + ExpP3) * x + ExpP4) * x + ExpP5;
+            y = y * x * x + x + 1.0f;
+            return std::ldexp(y, (int)fx);
+        }
+
+        // Writes softmax(x / temperature) to y and, when z is given, softmax(x)
+        // to z. Both share the max and one pass of exponentials.
+        void softmaxScalar(const float* x, int n, float temperature, float* y, float* z) {
+            float max = std::numeric_limits<float>::lowest();
+            for (int i = 0; i < n; ++i) {
+                max = std::max(max, x[i]);
+            }
+            float inverseTemperature = 1.0f / temperature;
+            float sumY = 0.0f;
+            float sumZ = 0.0f;
+            for (int i = 0; i < n; ++i) {
+                y[i] = std::exp((x[i] - max) * inverseTemperature);
+                sumY += y[i];
+                if (z != nullptr) {
+                    z[i] = std::exp(x[i] - max);
+                    sumZ += z[i];
+                }
+            }
+            scaleScalar<0>(y, 1.0f / sumY, n);
+            if (z != nullptr) {
+                scaleScalar<0>(z, 1.0f / sumZ, n);
+            }
+        }
+
+        // sigmoid(x) = 1 / (1 + e) for x >= 0 and e / (1 + e) otherwise, with
+        // e = exp(-|x|), so the exponential never overflows.
+        void sigmoidScalar(const float* x, float* y, int n) {
+            for (int i = 0; i < n; ++i) {
+                float e = std::exp(-std::abs(x[i]));
+                float s = 1.0f / (1.0f + e);
+                y[i] = x[i] >= 0.0f ? s : e * s;
+            }
+        }
+
+        // half precision conversions
+
+        bool stochasticRounding = false;
+        thread_local uint32_t roundingState = 495;
+
+        inline uint32_t nextRoundingNoise() {
+            roundingState ^= roundingState << 13;
+            roundingState ^= roundingState >> 17;
+            roundingState ^= roundingState << 5;
+            return roundingState;
+        }
+
+        inline float bf16ToFloat(uint16_t x) {
+            uint32_t bits = (uint32_t)x << 16;
+            float value;
+            std::memcpy(&value, &bits, sizeof(float));
+            return value;
+        }
+
+        inline uint16_t floatToBf16(float x) {
+            uint32_t bits;
+            std::memcpy(&bits, &x, sizeof(float));
+            if (stochasticRounding) {
+                bits += nextRoundingNoise() & 0xffff;
+            } else {
+                bits += 0x7fff + ((bits >> 16) & 1);
+            }
+            return (uint16_t)(bits >> 16);
+        }
+
+        inline float fp16ToFloat(uint16_t x) {
+            uint32_t sign = (uint32_t)(x & 0x8000) << 16;
+            uint32_t exponent = (x >> 10) & 0x1f;
+            uint32_t mantissa = x & 0x3ff;
+            uint32_t bits;
+            if (exponent == 0x1f) {
+                bits = sign | 0x7f800000 | (mantissa << 13);
+            } else if (exponent != 0) {
+                bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+            } else {
+                // zero or subnormal: mantissa * 2^-24
+                float value = mantissa * (1.0f / 16777216.0f);
+                return sign ? -value : value;
+            }
+            float value;
+            std::memcpy(&value, &bits, sizeof(float));
+            return value;
+        }
+
+        inline uint16_t floatToFp16(float x) {
+            uint32_t bits;
+            std::memcpy(&bits, &x, sizeof(float));
+            uint16_t sign = (bits >> 16) & 0x8000;
+            bits &= 0x7fffffff;
+            if (bits >= 0x47800000) {
+                // overflow to infinity
+                return sign | 0x7c00;
+            }
+            if (bits < 0x38800000) {
+                // below the smallest normal: round to a multiple of 2^-24
+                float value;
+                std::memcpy(&value, &bits, sizeof(float));
+                return sign | (uint16_t)std::nearbyint(value * 16777216.0f);
+            }
+            // rebias the exponent and round to nearest even
+            bits += 0xfff + ((bits >> 13) & 1);
+            return sign | (uint16_t)((bits - 0x38000000) >> 13);
+        }
+
+        void widenScalar(float* y, const uint16_t* x, int n, Precision precision) {
+            if (precision == Precision::Bf16) {
+                for (int i = 0; i < n; ++i) {
+                    y[i] = bf16ToFloat(x[i]);
+                }
+            } else {
+                for (int i = 0; i < n; ++i) {
+                    y[i] = fp16ToFloat(x[i]);
+                }
+            }
+        }
+
+        void narrowScalar(uint16_t* y, const float* x, int n, Precision precision) {
+            if (precision == Precision::Bf16) {
+                for (int i = 0; i < n; ++i) {
+                    y[i] = floatToBf16(x[i]);
+                }
+            } else {
+                for (int i = 0; i < n; ++i) {
+                    y[i] = floatToFp16(x[i]);
+                }
+            }
+        }
+
+        // gemm
+        //
+        // gemmNT computes tiles of up to GemmRows rows of A against a few rows
+        // of B at once, so every load of A or B feeds several dot products.
+        // gemmNN and gemmTN hold up to GemmRows rows of C by two vectors in
+        // registers while the rows of B stream past, so C is read and written
+        // once instead of once per row of B. Both work on blocks of GemmDepth
+        // columns so that the rows in use stay in L1.
+        const int GemmRows = 4;
+        const int GemmDepth = 512;
+
+        // sums[r * cols + c] = a[r]' * b[c] over k floats
+        typedef void (*GemmDotTile)(const float* const* a, const float* const* b, int k, float* sums);
+        // c[r] += sum over t of coefficients[r][t * coefficientStride] * b[t]
+        // over width floats
+        typedef void (*GemmAccumulateTile)(float* const* c, const float* const* coefficients, int coefficientStride, const float* b, int ldb, int inner, int width);
+
+        // Tiles holds the tiles of one isa for every size, so that the edges
+        // of a block need no padding: dot[r - 1][c - 1] takes r rows of A and
+        // c rows of B, accumulate[r - 1] r rows of C.
+        template <class Tiles>
+        void gemmNTBlocked(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc) {
+            const float* rowsA[GemmRows];
+            const float* rowsB[Tiles::Cols];
+            float sums[GemmRows * Tiles::Cols];
+            // k == 0 still runs one empty block, which writes zeros
+            for (int k0 = 0; k0 == 0 || k0 < k; k0 += GemmDepth) {
+                int depth = std::min(GemmDepth, k - k0);
+                for (int i = 0; i < m; i += GemmRows) {
+                    int rows = std::min(GemmRows, m - i);
+                    for (int r = 0; r < rows; ++r) {
+                        rowsA[r] = a + (i + r) * lda + k0;
+                    }
+                    for (int j = 0; j < n; j += Tiles::Cols) {
+                        int cols = std::min((int)Tiles::Cols, n - j);
+                        for (int col = 0; col < cols; ++col) {
+                            rowsB[col] = b + (j + col) * ldb + k0;
+                        }
+                        Tiles::dot[rows - 1][cols - 1](rowsA, rowsB, depth, sums);
+                        for (int r = 0; r < rows; ++r) {
+                            float* rowC = c + (i + r) * ldc + j;
+                            for (int col = 0; col < cols; ++col) {
+                                rowC[col] = k0 == 0 ? sums[r * cols + col] : rowC[col] + sums[r * cols + col];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // C[rows x k] += coefficients * B[inner x k], where the coefficient of
+        // row r of C and row t of B is a[r * rowStride + t * innerStride]
+        template <class Tiles>
+        void gemmAccumulate(int rows, int inner, int k, const float* a, int rowStride, int innerStride, const float* b, int ldb, float* c, int ldc) {
+            float* rowsC[GemmRows];
+            const float* coefficients[GemmRows];
+            for (int k0 = 0; k0 < k; k0 += GemmDepth) {
+                int depth = std::min(GemmDepth, k - k0);
+                for (int i = 0; i < rows; i += GemmRows) {
+                    int tileRows = std::min(GemmRows, rows - i);
+                    for (int r = 0; r < tileRows; ++r) {
+                        rowsC[r] = c + (i + r) * ldc + k0;
+                        coefficients[r] = a + (i + r) * rowStride;
+                    }
+                    Tiles::accumulate[tileRows - 1](rowsC, coefficients, innerStride, b + k0, ldb, inner, depth);
+                }
+            }
+        }
+
+        template <class Tiles>
+        void gemmNNBlocked(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc) {
+            gemmAccumulate<Tiles>(m, n, k, a, lda, 1, b, ldb, c, ldc);
+        }
+
+        template <class Tiles>
+        void gemmTNBlocked(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc) {
+            gemmAccumulate<Tiles>(n, m, k, a, 1, lda, b, ldb, c, ldc);
+        }
+
+        template <int Rows, int Cols>
+        void gemmDotTileScalar(const float* const* a, const float* const* b, int k, float* sums) {
+            float acc[Rows][Cols] = {};
+            for (int t = 0; t < k; ++t) {
+                for (int r = 0; r < Rows; ++r) {
+                    for (int col = 0; col < Cols; ++col) {
+                        acc[r][col] += a[r][t] * b[col][t];
+                    }
+                }
+            }
+            for (int r = 0; r < Rows; ++r) {
+                for (int col = 0; col < Cols; ++col) {
+                    sums[r * Cols + col] = acc[r][col];
+                }
+            }
+        }
+
+        // Row by row, so that the compiler vectorizes the updates.
+        template <int Rows>
+        void gemmAccumulateTileScalar(float* const* c, const float* const* coefficients, int coefficientStride, const float* b, int ldb, int inner, int width) {
+            for (int r = 0; r < Rows; ++r) {
+                for (int t = 0; t < inner; ++t) {
+                    float coefficient = coefficients[r][t * coefficientStride];
+                    if (coefficient != 0.0f) {
+                        axpyScalar<0>(c[r], b + t * ldb, coefficient, width);
+                    }
+                }
+            }
+        }
+
+        struct GemmTilesScalar {
+            static const int Cols = 2;
+            static const GemmDotTile dot[GemmRows][Cols];
+            static const GemmAccumulateTile accumulate[GemmRows];
+        };
+
+        const GemmDotTile GemmTilesScalar::dot[GemmRows][GemmTilesScalar::Cols] = {
+            {gemmDotTileScalar<1, 1>, gemmDotTileScalar<1, 2>},
+            {gemmDotTileScalar<2, 1>, gemmDotTileScalar<2, 2>},
+            {gemmDotTileScalar<3, 1>, gemmDotTileScalar<3, 2>},
+            {gemmDotTileScalar<4, 1>, gemmDotTileScalar<4, 2>},
+        };
+
+        const GemmAccumulateTile GemmTilesScalar::accumulate[GemmRows] = {
+            gemmAccumulateTileScalar<1>, gemmAccumulateTileScalar<2>, gemmAccumulateTileScalar<3>, gemmAccumulateTileScalar<4>,
+        };
+
+#ifdef SV4D_X86
+
+        // sse
+
+        template <int N>
+        __attribute__((target("sse2")))
+        float dotSse(const float* x, const float* y, int size) {
+            const int n = N > 0 ? N : size;
+            __m128 acc0 = _mm_setzero_ps();
+            __m128 acc1 = _mm_setzero_ps();
+            int i = 0;
+            for (; i + 8 <= n; i += 8) {
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+                acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4)));
+            }
+            for (; i + 4 <= n; i += 4) {
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+            }
+            acc0 = _mm_add_ps(acc0, acc1);
+            acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+            acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+            float dot = _mm_cvtss_f32(acc0);
+            if (N == 0 || N % 4 != 0) {
+                for (; i < n; ++i) {
+                    dot += x[i] * y[i];
+                }
+            }
+            return dot;
+        }
+
+        template <int N>
+        __attribute__((target("sse2")))
+        void axpySse(float* y, const float* x, float a, int size) {
+            const int n = N > 0 ? N : size;
+            __m128 va = _mm_set1_ps(a);
+            int i = 0;
+            for (; i + 4 <= n; i += 4) {
+                _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(_mm_loadu_ps(x + i), va)));
+            }
+            if (N == 0 || N % 4 != 0) {
+                for (; i < n; ++i) {
+                    y[i] += x[i] * a;
+                }
+            }
+        }
+
+        template <int N>
+        __attribute__((target("sse2")))
+        void scaleSse(float* x, float a, int size) {
+            const int n = N > 0 ? N : size;
+            __m128 va = _mm_set1_ps(a);
+            int i = 0;
+            for (; i + 4 <= n; i += 4) {
+                _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), va));
+            }
+            if (N == 0 || N % 4 != 0) {
+                for (; i < n; ++i) {
+                    x[i] *= a;
+                }
+            }
+        }
+
+        __attribute__((target("sse2")))
+        inline __m128 expSse(__m128 x) {
+            x = _mm_max_ps(x, _mm_set1_ps(ExpMin));
+            __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(ExpLog2e)), _mm_set1_ps(0.5f));
+            __m128 tx = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+            fx = _mm_sub_ps(tx, _mm_and_ps(_mm_cmpgt_ps(tx, fx), _mm_set1_ps(1.0f)));
+            x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(ExpC1)));
+            x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(ExpC2)));
+            __m128 y = _mm_set1_ps(ExpP0);
+            y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(ExpP1));
+            y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(ExpP2));
+            y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(ExpP3));
+            y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(ExpP4));
+            y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(ExpP5));
+            y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, x), x), x), _mm_set1_ps(1.0f));
+            __m128i e = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+            return _mm_mul_ps(y, _mm_castsi128_ps(e));
+        }
+
+        __attribute__((target("sse2")))
+        inline float sumSse(__m128 v) {
+            v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+            v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+            return _mm_cvtss_f32(v);
+        }
+
+        __attribute__((target("sse2")))
+        void softmaxSse(const float* x, int n, float temperature, float* y, float* z) {
+            float max = std::numeric_limits<float>::lowest();
+            for (int i = 0; i < n; ++i) {
+                max = std::max(max, x[i]);
+            }
+            float inverseTemperature = 1.0f / temperature;
+            __m128 vmax = _mm_set1_ps(max);
+            __m128 vt = _mm_set1_ps(inverseTemperature);
+            __m128 sumY = _mm_setzero_ps();
+            __m128 sumZ = _mm_setzero_ps();
+            int i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m128 d = _mm_sub_ps(_mm_loadu_ps(x + i), vmax);
+                __m128 ey = expSse(_mm_mul_ps(d, vt));
+                _mm_storeu_ps(y + i, ey);
+                sumY = _mm_add_ps(sumY, ey);
+                if (z != nullptr) {
+                    __m128 ez = expSse(d);
+                    _mm_storeu_ps(z + i, ez);
+                    sumZ = _mm_add_ps(sumZ, ez);
+                }
+            }
+            float sy = sumSse(sumY);
+            float sz = sumSse(sumZ);
+            for (; i < n; ++i) {
+                y[i] = expApprox((x[i] - max) * inverseTemperature);
+                sy += y[i];
+                if (z != nullptr) {
+                    z[i] = expApprox(x[i] - max);
+                    sz += z[i];
+                }
+            }
+            scaleSse<0>(y, 1.0f / sy, n);
+            if (z != nullptr) {
+                scaleSse<0>(z, 1.0f / sz, n);
+            }
+        }
+
+        __attribute__((target("sse2")))
+        void sigmoidSse(const float* x, float* y, int n) {
+            const __m128 signMask = _mm_set1_ps(-0.0f);
+            const __m128 one = _mm_set1_ps(1.0f);
+            int i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m128 vx = _mm_loadu_ps(x + i);
+                __m128 e = expSse(_mm_or_ps(vx, signMask));
+                __m128 s = _mm_div_ps(one, _mm_add_ps(one, e));
+                __m128 negative = _mm_cmplt_ps(vx, _mm_setzero_ps());
+                _mm_storeu_ps(y + i, _mm_or_ps(_mm_and_ps(negative, _mm_mul_ps(e, s)), _mm_andnot_ps(negative, s)));
+            }
+            sigmoidScalar(x + i, y + i, n - i);
+        }
+
+        // Bytes are sign extended to 16 bits by unpacking each one into the
+        // high half of a word and shifting it back down.
+        __attribute__((target("sse2")))
+        int32_t dotInt8Sse(const int8_t* x, const int8_t* y, int n) {
+            __m128i acc = _mm_setzero_si128();
+            int i = 0;
+            for (; i + 16 <= n; i += 16) {
+                __m128i vx = _mm_loadu_si128((const __m128i*)(x + i));
+                __m128i vy = _mm_loadu_si128((const __m128i*)(y + i));
+                __m128i xl = _mm_srai_epi16(_mm_unpacklo_epi8(vx, vx), 8);
+                __m128i xh = _mm_srai_epi16(_mm_unpackhi_epi8(vx, vx), 8);
+                __m128i yl = _mm_srai_epi16(_mm_unpacklo_epi8(vy, vy), 8);
+                __m128i yh = _mm_srai_epi16(_mm_unpackhi_epi8(vy, vy), 8);
+                acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(xl, yl), _mm_madd_epi16(xh, yh)));
+            }
+            alignas(16) int32_t lanes[4];
+            _mm_store_si128((__m128i*)lanes, acc);
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotInt8Scalar(x + i, y + i, n - i);
+        }
+
+        template <int Rows, int Cols>
+        __attribute__((target("sse2")))
+        void gemmDotTileSse(const float* const* a, const float* const* b, int k, float* sums) {
+            __m128 acc[Rows][Cols];
+            for (int r = 0; r < Rows; ++r) {
+                for (int col = 0; col < Cols; ++col) {
+                    acc[r][col] = _mm_setzero_ps();
+                }
+            }
+            int t = 0;
+            for (; t + 4 <= k; t += 4) {
+                __m128 vb[Cols];
+                for (int col = 0; col < Cols; ++col) {
+                    vb[col] = _mm_loadu_ps(b[col] + t);
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    __m128 va = _mm_loadu_ps(a[r] + t);
+                    for (int col = 0; col < Cols; ++col) {
+                        acc[r][col] = _mm_add_ps(acc[r][col], _mm_mul_ps(va, vb[col]));
+                    }
+                }
+            }
+            for (int r = 0; r < Rows; ++r) {
+                for (int col = 0; col < Cols; ++col) {
+                    sums[r * Cols + col] = sumSse(acc[r][col]) + dotScalar<0>(a[r] + t, b[col] + t, k - t);
+                }
+            }
+        }
+
+        template <int Rows>
+        __attribute__((target("sse2")))
+        void gemmAccumulateTileSse(float* const* c, const float* const* coefficients, int coefficientStride, const float* b, int ldb, int inner, int width) {
+            int col = 0;
+            for (; col + 8 <= width; col += 8) {
+                __m128 acc[Rows][2];
+                for (int r = 0; r < Rows; ++r) {
+                    acc[r][0] = _mm_loadu_ps(c[r] + col);
+                    acc[r][1] = _mm_loadu_ps(c[r] + col + 4);
+                }
+                for (int t = 0; t < inner; ++t) {
+                    __m128 b0 = _mm_loadu_ps(b + t * ldb + col);
+                    __m128 b1 = _mm_loadu_ps(b + t * ldb + col + 4);
+                    for (int r = 0; r < Rows; ++r) {
+                        __m128 va = _mm_set1_ps(coefficients[r][t * coefficientStride]);
+                        acc[r][0] = _mm_add_ps(acc[r][0], _mm_mul_ps(va, b0));
+                        acc[r][1] = _mm_add_ps(acc[r][1], _mm_mul_ps(va, b1));
+                    }
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    _mm_storeu_ps(c[r] + col, acc[r][0]);
+                    _mm_storeu_ps(c[r] + col + 4, acc[r][1]);
+                }
+            }
+            if (col < width) {
+                float* tail[Rows];
+                for (int r = 0; r < Rows; ++r) {
+                    tail[r] = c[r] + col;
+                }
+                gemmAccumulateTileScalar<Rows>(tail, coefficients, coefficientStride, b + col, ldb, inner, width - col);
+            }
+        }
+
+        struct GemmTilesSse {
+            static const int Cols = 2;
+            static const GemmDotTile dot[GemmRows][Cols];
+            static const GemmAccumulateTile accumulate[GemmRows];
+        };
+
+        const GemmDotTile GemmTilesSse::dot[GemmRows][GemmTilesSse::Cols] = {
+            {gemmDotTileSse<1, 1>, gemmDotTileSse<1, 2>},
+            {gemmDotTileSse<2, 1>, gemmDotTileSse<2, 2>},
+            {gemmDotTileSse<3, 1>, gemmDotTileSse<3, 2>},
+            {gemmDotTileSse<4, 1>, gemmDotTileSse<4, 2>},
+        };
+
+        const GemmAccumulateTile GemmTilesSse::accumulate[GemmRows] = {
+            gemmAccumulateTileSse<1>, gemmAccumulateTileSse<2>, gemmAccumulateTileSse<3>, gemmAccumulateTileSse<4>,
+        };
+
+        // avx2 + fma
+
+        template <int N>
+        __attribute__((target("avx2,fma")))
+        float dotAvx2(const float* x, const float* y, int size) {
+            const int n = N > 0 ? N : size;
+            __m256 acc0 = _mm256_setzero_ps();
+            __m256 acc1 = _mm256_setzero_ps();
+            __m256 acc2 = _mm256_setzero_ps();
+            __m256 acc3 = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 32 <= n; i += 32) {
+                acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+                acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), acc1);
+                acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 16), _mm256_loadu_ps(y + i + 16), acc2);
+                acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 24), _mm256_loadu_ps(y + i + 24), acc3);
+            }
+            for (; i + 8 <= n; i += 8) {
+                acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), acc0);
+            }
+            acc0 = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            float dot = _mm_cvtss_f32(sum);
+            if (N == 0 || N % 8 != 0) {
+                for (; i < n; ++i) {
+                    dot += x[i] * y[i];
+                }
+            }
+            return dot;
+        }
+
+        template <int N>
+        __attribute__((target("avx2,fma")))
+        void axpyAvx2(float* y, const float* x, float a, int size) {
+            const int n = N > 0 ? N : size;
+            __m256 va = _mm256_set1_ps(a);
+            int i = 0;
+            for (; i + 16 <= n; i += 16) {
+                _mm256_storeu_ps(y + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), va, _mm256_loadu_ps(y + i)));
+                _mm256_storeu_ps(y + i + 8, _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), va, _mm256_loadu_ps(y + i + 8)));
+            }
+            for (; i + 8 <= n; i += 8) {
+                _mm256_storeu_ps(y + i, _mm256_fmadd_ps(_mm256_loadu_ps(x + i), va, _mm256_loadu_ps(y + i)));
+            }
+            if (N == 0 || N % 8 != 0) {
+                for (; i < n; ++i) {
+                    y[i] += x[i] * a;
+                }
+            }
+        }
+
+        template <int N>
+        __attribute__((target("avx2,fma")))
+        void scaleAvx2(float* x, float a, int size) {
+            const int n = N > 0 ? N : size;
+            __m256 va = _mm256_set1_ps(a);
+            int i = 0;
+            for (; i + 8 <= n; i += 8) {
+                _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), va));
+            }
+            if (N == 0 || N % 8 != 0) {
+                for (; i < n; ++i) {
+                    x[i] *= a;
+                }
+            }
+        }
+
+        __attribute__((target("avx2,fma")))
+        inline __m256 expAvx2(__m256 x) {
+            x = _mm256_max_ps(x, _mm256_set1_ps(ExpMin));
+            __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(ExpLog2e), _mm256_set1_ps(0.5f)));
+            x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(ExpC1), x);
+            x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(ExpC2), x);
+            __m256 y = _mm256_set1_ps(ExpP0);
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(ExpP1));
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(ExpP2));
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(ExpP3));
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(ExpP4));
+            y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(ExpP5));
+            y = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(y, x), x, x), _mm256_set1_ps(1.0f));
+            __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fx), _mm256_set1_epi32(127)), 23);
+            return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+        }
+
+        __attribute__((target("avx2,fma")))
+        inline float sumAvx2(__m256 v) {
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            return _mm_cvtss_f32(sum);
+        }
+
+        __attribute__((target("avx2,fma")))
+        void softmaxAvx2(const float* x, int n, float temperature, float* y, float* z) {
+            float max = std::numeric_limits<float>::lowest();
+            for (int i = 0; i < n; ++i) {
+                max = std::max(max, x[i]);
+            }
+            float inverseTemperature = 1.0f / temperature;
+            __m256 vmax = _mm256_set1_ps(max);
+            __m256 vt = _mm256_set1_ps(inverseTemperature);
+            __m256 sumY = _mm256_setzero_ps();
+            __m256 sumZ = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m256 d = _mm256_sub_ps(_mm256_loadu_ps(x + i), vmax);
+                __m256 ey = expAvx2(_mm256_mul_ps(d, vt));
+                _mm256_storeu_ps(y + i, ey);
+                sumY = _mm256_add_ps(sumY, ey);
+                if (z != nullptr) {
+                    __m256 ez = expAvx2(d);
+                    _mm256_storeu_ps(z + i, ez);
+                    sumZ = _mm256_add_ps(sumZ, ez);
+                }
+            }
+            float sy = sumAvx2(sumY);
+            float sz = sumAvx2(sumZ);
+            for (; i < n; ++i) {
+                y[i] = expApprox((x[i] - max) * inverseTemperature);
+                sy += y[i];
+                if (z != nullptr) {
+                    z[i] = expApprox(x[i] - max);
+                    sz += z[i];
+                }
+            }
+            scaleAvx2<0>(y, 1.0f / sy, n);
+            if (z != nullptr) {
+                scaleAvx2<0>(z, 1.0f / sz, n);
+            }
+        }
+
+        __attribute__((target("avx2,fma")))
+        void sigmoidAvx2(const float* x, float* y, int n) {
+            const __m256 signMask = _mm256_set1_ps(-0.0f);
+            const __m256 one = _mm256_set1_ps(1.0f);
+            int i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m256 vx = _mm256_loadu_ps(x + i);
+                __m256 e = expAvx2(_mm256_or_ps(vx, signMask));
+                __m256 s = _mm256_div_ps(one, _mm256_add_ps(one, e));
+                _mm256_storeu_ps(y + i, _mm256_blendv_ps(s, _mm256_mul_ps(e, s), vx));
+            }
+            sigmoidScalar(x + i, y + i, n - i);
+        }
+
+        // maddubs multiplies unsigned by signed bytes, so |x| is paired with y
+        // carrying the sign of x. Quantized values lie in [-127, 127], hence
+        // the pairwise 16-bit sums cannot saturate.
+        __attribute__((target("avx2,fma")))
+        int32_t dotInt8Avx2(const int8_t* x, const int8_t* y, int n) {
+            const __m256i ones = _mm256_set1_epi16(1);
+            __m256i acc = _mm256_setzero_si256();
+            int i = 0;
+            for (; i + 32 <= n; i += 32) {
+                __m256i vx = _mm256_loadu_si256((const __m256i*)(x + i));
+                __m256i vy = _mm256_loadu_si256((const __m256i*)(y + i));
+                __m256i pairs = _mm256_maddubs_epi16(_mm256_sign_epi8(vx, vx), _mm256_sign_epi8(vy, vx));
+                acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+            }
+            alignas(32) int32_t lanes[8];
+            _mm256_store_si256((__m256i*)lanes, acc);
+            int32_t dot = 0;
+            for (int j = 0; j < 8; ++j) {
+                dot += lanes[j];
+            }
+            return dot + dotInt8Scalar(x + i, y + i, n - i);
+        }
+
+        __attribute__((target("avx2,fma,f16c")))
+        void widenAvx2(float* y, const uint16_t* x, int n, Precision precision) {
+            int i = 0;
+            if (precision == Precision::Bf16) {
+                for (; i + 8 <= n; i += 8) {
+                    __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(x + i)));
+                    _mm256_storeu_ps(y + i, _mm256_castsi256_ps(_mm256_slli_epi32(v, 16)));
+                }
+            } else {
+                for (; i + 8 <= n; i += 8) {
+                    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(x + i))));
+                }
+            }
+            widenScalar(y + i, x + i, n - i, precision);
+        }
+
+        __attribute__((target("avx2,fma,f16c")))
+        void narrowAvx2(uint16_t* y, const float* x, int n, Precision precision) {
+            int i = 0;
+            if (precision == Precision::Bf16) {
+                if (stochasticRounding) {
+                    narrowScalar(y, x, n, precision);
+                    return;
+                }
+                __m256i bias = _mm256_set1_epi32(0x7fff);
+                __m256i one = _mm256_set1_epi32(1);
+                for (; i + 8 <= n; i += 8) {
+                    __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(x + i));
+                    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+                    bits = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(bias, odd)), 16);
+                    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(bits, bits), 0x08);
+                    _mm_storeu_si128((__m128i*)(y + i), _mm256_castsi256_si128(packed));
+                }
+            } else {
+                for (; i + 8 <= n; i += 8) {
+                    _mm_storeu_si128((__m128i*)(y + i), _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+                }
+            }
+            narrowScalar(y + i, x + i, n - i, precision);
+        }
+
+        const int32_t TailLanes[16] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+
+        // Mask of the first n <= 8 lanes, for loads of row tails.
+        __attribute__((target("avx2,fma")))
+        inline __m256i tailMaskAvx2(int n) {
+            return _mm256_loadu_si256((const __m256i*)(TailLanes + 8 - n));
+        }
+
+        template <int Rows, int Cols>
+        __attribute__((target("avx2,fma")))
+        void gemmDotTileAvx2(const float* const* a, const float* const* b, int k, float* sums) {
+            __m256 acc[Rows][Cols];
+            for (int r = 0; r < Rows; ++r) {
+                for (int col = 0; col < Cols; ++col) {
+                    acc[r][col] = _mm256_setzero_ps();
+                }
+            }
+            int t = 0;
+            for (; t + 8 <= k; t += 8) {
+                __m256 vb[Cols];
+                for (int col = 0; col < Cols; ++col) {
+                    vb[col] = _mm256_loadu_ps(b[col] + t);
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    __m256 va = _mm256_loadu_ps(a[r] + t);
+                    for (int col = 0; col < Cols; ++col) {
+                        acc[r][col] = _mm256_fmadd_ps(va, vb[col], acc[r][col]);
+                    }
+                }
+            }
+            if (t < k) {
+                __m256i mask = tailMaskAvx2(k - t);
+                __m256 vb[Cols];
+                for (int col = 0; col < Cols; ++col) {
+                    vb[col] = _mm256_maskload_ps(b[col] + t, mask);
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    __m256 va = _mm256_maskload_ps(a[r] + t, mask);
+                    for (int col = 0; col < Cols; ++col) {
+                        acc[r][col] = _mm256_fmadd_ps(va, vb[col], acc[r][col]);
+                    }
+                }
+            }
+            for (int r = 0; r < Rows; ++r) {
+                for (int col = 0; col < Cols; ++col) {
+                    sums[r * Cols + col] = sumAvx2(acc[r][col]);
+                }
+            }
+        }
+
+        template <int Rows>
+        __attribute__((target("avx2,fma")))
+        void gemmAccumulateTileAvx2(float* const* c, const float* const* coefficients, int coefficientStride, const float* b, int ldb, int inner, int width) {
+            int col = 0;
+            for (; col + 16 <= width; col += 16) {
+                __m256 acc[Rows][2];
+                for (int r = 0; r < Rows; ++r) {
+                    acc[r][0] = _mm256_loadu_ps(c[r] + col);
+                    acc[r][1] = _mm256_loadu_ps(c[r] + col + 8);
+                }
+                for (int t = 0; t < inner; ++t) {
+                    __m256 b0 = _mm256_loadu_ps(b + t * ldb + col);
+                    __m256 b1 = _mm256_loadu_ps(b + t * ldb + col + 8);
+                    for (int r = 0; r < Rows; ++r) {
+                        __m256 va = _mm256_broadcast_ss(coefficients[r] + t * coefficientStride);
+                        acc[r][0] = _mm256_fmadd_ps(va, b0, acc[r][0]);
+                        acc[r][1] = _mm256_fmadd_ps(va, b1, acc[r][1]);
+                    }
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    _mm256_storeu_ps(c[r] + col, acc[r][0]);
+                    _mm256_storeu_ps(c[r] + col + 8, acc[r][1]);
+                }
+            }
+            for (; col < width; col += 8) {
+                __m256i mask = tailMaskAvx2(std::min(8, width - col));
+                __m256 acc[Rows];
+                for (int r = 0; r < Rows; ++r) {
+                    acc[r] = _mm256_maskload_ps(c[r] + col, mask);
+                }
+                for (int t = 0; t < inner; ++t) {
+                    __m256 vb = _mm256_maskload_ps(b + t * ldb + col, mask);
+                    for (int r = 0; r < Rows; ++r) {
+                        acc[r] = _mm256_fmadd_ps(_mm256_broadcast_ss(coefficients[r] + t * coefficientStride), vb, acc[r]);
+                    }
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    _mm256_maskstore_ps(c[r] + col, mask, acc[r]);
+                }
+            }
+        }
+
+        struct GemmTilesAvx2 {
+            static const int Cols = 2;
+            static const GemmDotTile dot[GemmRows][Cols];
+            static const GemmAccumulateTile accumulate[GemmRows];
+        };
+
+        const GemmDotTile GemmTilesAvx2::dot[GemmRows][GemmTilesAvx2::Cols] = {
+            {gemmDotTileAvx2<1, 1>, gemmDotTileAvx2<1, 2>},
+            {gemmDotTileAvx2<2, 1>, gemmDotTileAvx2<2, 2>},
+            {gemmDotTileAvx2<3, 1>, gemmDotTileAvx2<3, 2>},
+            {gemmDotTileAvx2<4, 1>, gemmDotTileAvx2<4, 2>},
+        };
+
+        const GemmAccumulateTile GemmTilesAvx2::accumulate[GemmRows] = {
+            gemmAccumulateTileAvx2<1>, gemmAccumulateTileAvx2<2>, gemmAccumulateTileAvx2<3>, gemmAccumulateTileAvx2<4>,
+        };
+
+        // avx512
+
+        // The masked forms below take an explicit source register; the
+        // unmasked ones start from an undefined register, which GCC 12
+        // reports as uninitialized under -flto.
+        const __mmask16 AllLanes = 0xffff;
+        const __mmask64 AllBytes = ~(__mmask64)0;
+
+        template <int N>
+        __attribute__((target("avx512f")))
+        float dotAvx512(const float* x, const float* y, int size) {
+            const int n = N > 0 ? N : size;
+            __m512 acc0 = _mm512_setzero_ps();
+            __m512 acc1 = _mm512_setzero_ps();
+            int i = 0;
+            for (; i + 32 <= n; i += 32) {
+                acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+                acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16), acc1);
+            }
+            for (; i + 16 <= n; i += 16) {
+                acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc0);
+            }
+            if (i < n) {
+                __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+                acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i), _mm512_maskz_loadu_ps(mask, y + i), acc1);
+            }
+            alignas(64) float lanes[16];
+            _mm512_store_ps(lanes, _mm512_add_ps(acc0, acc1));
+            __m256 half = _mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8));
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(half), _mm256_extractf128_ps(half, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            return _mm_cvtss_f32(sum);
+        }
+
+        template <int N>
+        __attribute__((target("avx512f")))
+        void axpyAvx512(float* y, const float* x, float a, int size) {
+            const int n = N > 0 ? N : size;
+            __m512 va = _mm512_set1_ps(a);
+            int i = 0;
+            for (; i + 16 <= n; i += 16) {
+                _mm512_storeu_ps(y + i, _mm512_fmadd_ps(_mm512_loadu_ps(x + i), va, _mm512_loadu_ps(y + i)));
+            }
+            if (i < n) {
+                __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+                __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+                _mm512_mask_storeu_ps(y + i, mask, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i), va, vy));
+            }
+        }
+
+        template <int N>
+        __attribute__((target("avx512f")))
+        void scaleAvx512(float* x, float a, int size) {
+            const int n = N > 0 ? N : size;
+            __m512 va = _mm512_set1_ps(a);
+            int i = 0;
+            for (; i + 16 <= n; i += 16) {
+                _mm512_storeu_ps(x + i, _mm512_mul_ps(_mm512_loadu_ps(x + i), va));
+            }
+            if (i < n) {
+                __mmask16 mask = (__mmask16)((1u << (n - i)) - 1);
+                _mm512_mask_storeu_ps(x + i, mask, _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, x + i), va));
+            }
+        }
+
+        __attribute__((target("avx512f")))
+        inline __m512 expAvx512(__m512 x) {
+            x = _mm512_mask_max_ps(x, AllLanes, x, _mm512_set1_ps(ExpMin));
+            __m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(ExpLog2e), _mm512_set1_ps(0.5f));
+            fx = _mm512_mask_roundscale_ps(fx, AllLanes, fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+            x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(ExpC1), x);
+            x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(ExpC2), x);
+            __m512 y = _mm512_set1_ps(ExpP0);
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(ExpP1));
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(ExpP2));
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(ExpP3));
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(ExpP4));
+            y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(ExpP5));
+            y = _mm512_add_ps(_mm512_fmadd_ps(_mm512_mul_ps(y, x), x, x), _mm512_set1_ps(1.0f));
+            return _mm512_mask_scalef_ps(y, AllLanes, y, fx);
+        }
+
+        __attribute__((target("avx512f")))
+        inline float sumAvx512(__m512 v) {
+            __m256 low = _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xf, _mm512_castps_pd(v), 0));
+            __m256 high = _mm256_castpd_ps(_mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xf, _mm512_castps_pd(v), 1));
+            __m256 half = _mm256_add_ps(low, high);
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(half), _mm256_extractf128_ps(half, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            return _mm_cvtss_f32(sum);
+        }
+
+        __attribute__((target("avx512f")))
+        void softmaxAvx512(const float* x, int n, float temperature, float* y, float* z) {
+            float max = std::numeric_limits<float>::lowest();
+            for (int i = 0; i < n; ++i) {
+                max = std::max(max, x[i]);
+            }
+            __m512 vmax = _mm512_set1_ps(max);
+            __m512 vt = _mm512_set1_ps(1.0f / temperature);
+            __m512 sumY = _mm512_setzero_ps();
+            __m512 sumZ = _mm512_setzero_ps();
+            for (int i = 0; i < n; i += 16) {
+                __mmask16 mask = n - i >= 16 ? AllLanes : (__mmask16)((1u << (n - i)) - 1);
+                __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i), vmax);
+                __m512 ey = _mm512_maskz_mov_ps(mask, expAvx512(_mm512_mul_ps(d, vt)));
+                _mm512_mask_storeu_ps(y + i, mask, ey);
+                sumY = _mm512_add_ps(sumY, ey);
+                if (z != nullptr) {
+                    __m512 ez = _mm512_maskz_mov_ps(mask, expAvx512(d));
+                    _mm512_mask_storeu_ps(z + i, mask, ez);
+                    sumZ = _mm512_add_ps(sumZ, ez);
+                }
+            }
+            scaleAvx512<0>(y, 1.0f / sumAvx512(sumY), n);
+            if (z != nullptr) {
+                scaleAvx512<0>(z, 1.0f / sumAvx512(sumZ), n);
+            }
+        }
+
+        __attribute__((target("avx512f")))
+        void sigmoidAvx512(const float* x, float* y, int n) {
+            const __m512 one = _mm512_set1_ps(1.0f);
+            for (int i = 0; i < n; i += 16) {
+                __mmask16 mask = n - i >= 16 ? AllLanes : (__mmask16)((1u << (n - i)) - 1);
+                __m512 vx = _mm512_maskz_loadu_ps(mask, x + i);
+                __m512 e = expAvx512(_mm512_sub_ps(_mm512_setzero_ps(), _mm512_abs_ps(vx)));
+                __m512 s = _mm512_div_ps(one, _mm512_add_ps(one, e));
+                __mmask16 negative = _mm512_cmp_ps_mask(vx, _mm512_setzero_ps(), _CMP_LT_OQ);
+                _mm512_mask_storeu_ps(y + i, mask, _mm512_mask_mul_ps(s, negative, e, s));
+            }
+        }
+
+        // Up to four rows of B per tile: sixteen accumulators still leave room
+        // in the 32 registers.
+        template <int Rows, int Cols>
+        __attribute__((target("avx512f")))
+        void gemmDotTileAvx512(const float* const* a, const float* const* b, int k, float* sums) {
+            __m512 acc[Rows][Cols];
+            for (int r = 0; r < Rows; ++r) {
+                for (int col = 0; col < Cols; ++col) {
+                    acc[r][col] = _mm512_setzero_ps();
+                }
+            }
+            int t = 0;
+            for (; t + 16 <= k; t += 16) {
+                __m512 vb[Cols];
+                for (int col = 0; col < Cols; ++col) {
+                    vb[col] = _mm512_loadu_ps(b[col] + t);
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    __m512 va = _mm512_loadu_ps(a[r] + t);
+                    for (int col = 0; col < Cols; ++col) {
+                        acc[r][col] = _mm512_fmadd_ps(va, vb[col], acc[r][col]);
+                    }
+                }
+            }
+            if (t < k) {
+                __mmask16 mask = (__mmask16)((1u << (k - t)) - 1);
+                __m512 vb[Cols];
+                for (int col = 0; col < Cols; ++col) {
+                    vb[col] = _mm512_maskz_loadu_ps(mask, b[col] + t);
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    __m512 va = _mm512_maskz_loadu_ps(mask, a[r] + t);
+                    for (int col = 0; col < Cols; ++col) {
+                        acc[r][col] = _mm512_fmadd_ps(va, vb[col], acc[r][col]);
+                    }
+                }
+            }
+            for (int r = 0; r < Rows; ++r) {
+                for (int col = 0; col < Cols; ++col) {
+                    sums[r * Cols + col] = sumAvx512(acc[r][col]);
+                }
+            }
+        }
+
+        template <int Rows>
+        __attribute__((target("avx512f")))
+        void gemmAccumulateTileAvx512(float* const* c, const float* const* coefficients, int coefficientStride, const float* b, int ldb, int inner, int width) {
+            for (int col = 0; col < width; col += 32) {
+                __mmask16 mask0 = width - col >= 16 ? AllLanes : (__mmask16)((1u << (width - col)) - 1);
+                __mmask16 mask1 = width - col >= 32 ? AllLanes : width - col <= 16 ? 0 : (__mmask16)((1u << (width - col - 16)) - 1);
+                __m512 acc[Rows][2];
+                for (int r = 0; r < Rows; ++r) {
+                    acc[r][0] = _mm512_maskz_loadu_ps(mask0, c[r] + col);
+                    acc[r][1] = _mm512_maskz_loadu_ps(mask1, c[r] + col + 16);
+                }
+                for (int t = 0; t < inner; ++t) {
+                    __m512 b0 = _mm512_maskz_loadu_ps(mask0, b + t * ldb + col);
+                    __m512 b1 = _mm512_maskz_loadu_ps(mask1, b + t * ldb + col + 16);
+                    for (int r = 0; r < Rows; ++r) {
+                        __m512 va = _mm512_set1_ps(coefficients[r][t * coefficientStride]);
+                        acc[r][0] = _mm512_fmadd_ps(va, b0, acc[r][0]);
+                        acc[r][1] = _mm512_fmadd_ps(va, b1, acc[r][1]);
+                    }
+                }
+                for (int r = 0; r < Rows; ++r) {
+                    _mm512_mask_storeu_ps(c[r] + col, mask0, acc[r][0]);
+                    _mm512_mask_storeu_ps(c[r] + col + 16, mask1, acc[r][1]);
+                }
+            }
+        }
+
+        struct GemmTilesAvx512 {
+            static const int Cols = 4;
+            static const GemmDotTile dot[GemmRows][Cols];
+            static const GemmAccumulateTile accumulate[GemmRows];
+        };
+
+        const GemmDotTile GemmTilesAvx512::dot[GemmRows][GemmTilesAvx512::Cols] = {
+            {gemmDotTileAvx512<1, 1>, gemmDotTileAvx512<1, 2>, gemmDotTileAvx512<1, 3>, gemmDotTileAvx512<1, 4>},
+            {gemmDotTileAvx512<2, 1>, gemmDotTileAvx512<2, 2>, gemmDotTileAvx512<2, 3>, gemmDotTileAvx512<2, 4>},
+            {gemmDotTileAvx512<3, 1>, gemmDotTileAvx512<3, 2>, gemmDotTileAvx512<3, 3>, gemmDotTileAvx512<3, 4>},
+            {gemmDotTileAvx512<4, 1>, gemmDotTileAvx512<4, 2>, gemmDotTileAvx512<4, 3>, gemmDotTileAvx512<4, 4>},
+        };
+
+        const GemmAccumulateTile GemmTilesAvx512::accumulate[GemmRows] = {
+            gemmAccumulateTileAvx512<1>, gemmAccumulateTileAvx512<2>, gemmAccumulateTileAvx512<3>, gemmAccumulateTileAvx512<4>,
+        };
+
+        // Same sign trick as dotInt8Avx2, with vpdpbusd accumulating four
+        // byte products straight into each 32-bit lane.
+        __attribute__((target("avx512f,avx512bw,avx512vnni")))
+        int32_t dotInt8Vnni(const int8_t* x, const int8_t* y, int n) {
+            const __m512i zero = _mm512_setzero_si512();
+            __m512i acc = _mm512_setzero_si512();
+            for (int i = 0; i < n; i += 64) {
+                __mmask64 mask = n - i >= 64 ? AllBytes : (((__mmask64)1 << (n - i)) - 1);
+                __m512i vx = _mm512_maskz_loadu_epi8(mask, x + i);
+                __m512i vy = _mm512_maskz_loadu_epi8(mask, y + i);
+                __mmask64 negative = _mm512_movepi8_mask(vx);
+                __m512i ax = _mm512_mask_abs_epi8(vx, AllBytes, vx);
+                __m512i sy = _mm512_mask_sub_epi8(vy, negative, zero, vy);
+                acc = _mm512_dpbusd_epi32(acc, ax, sy);
+            }
+            alignas(64) int32_t lanes[16];
+            _mm512_store_si512((__m512i*)lanes, acc);
+            int32_t dot = 0;
+            for (int j = 0; j < 16; ++j) {
+                dot += lanes[j];
+            }
+            return dot;
+        }
+
+#endif
+
+        // vpdpbusd is picked separately from the float kernels since it needs
+        // avx512vnni and avx512bw on top of avx512f.
+        bool supportsVnni() {
+#ifdef SV4D_X86
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw");
+#else
+            return false;
+#endif
+        }
+
+        template <int N>
+        Kernels makeKernels(Isa isa) {
+            switch (isa) {
+#ifdef SV4D_X86
+                case Isa::Avx512:
+                    return {Isa::Avx512, dotAvx512<N>, axpyAvx512<N>, scaleAvx512<N>, softmaxAvx512, sigmoidAvx512, widenAvx2, narrowAvx2, supportsVnni() ? dotInt8Vnni : dotInt8Avx2, gemmNTBlocked<GemmTilesAvx512>, gemmNNBlocked<GemmTilesAvx512>, gemmTNBlocked<GemmTilesAvx512>};
+                case Isa::Avx2:
+                    return {Isa::Avx2, dotAvx2<N>, axpyAvx2<N>, scaleAvx2<N>, softmaxAvx2, sigmoidAvx2, widenAvx2, narrowAvx2, dotInt8Avx2, gemmNTBlocked<GemmTilesAvx2>, gemmNNBlocked<GemmTilesAvx2>, gemmTNBlocked<GemmTilesAvx2>};
+                case Isa::Sse:
+                    return {Isa::Sse, dotSse<N>, axpySse<N>, scaleSse<N>, softmaxSse, sigmoidSse, widenScalar, narrowScalar, dotInt8Sse, gemmNTBlocked<GemmTilesSse>, gemmNNBlocked<GemmTilesSse>, gemmTNBlocked<GemmTilesSse>};
+#endif
+                default:
+                    return {Isa::Scalar, dotScalar<N>, axpyScalar<N>, scaleScalar<N>, softmaxScalar, sigmoidScalar, widenScalar, narrowScalar, dotInt8Scalar, gemmNTBlocked<GemmTilesScalar>, gemmNNBlocked<GemmTilesScalar>, gemmTNBlocked<GemmTilesScalar>};
+            }
+        }
+
+        Kernels active = {Isa::Scalar, dotScalar<0>, axpyScalar<0>, scaleScalar<0>, softmaxScalar, sigmoidScalar, widenScalar, narrowScalar, dotInt8Scalar, gemmNTBlocked<GemmTilesScalar>, gemmNNBlocked<GemmTilesScalar>, gemmTNBlocked<GemmTilesScalar>};
+
+        const Kernels* sized[MaxSizedKernel + 1] = {};
+
+        Kernels specialized[9];
+
+        template <int N>
+        void specialize(Isa isa, int slot) {
+            specialized[slot] = makeKernels<N>(isa);
+            sized[N] = &specialized[slot];
+        }
+
+        Isa detectIsa() {
+#ifdef SV4D_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("f16c")) {
+                return Isa::Avx512;
+            }
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) {
+                return Isa::Avx2;
+            }
+            if (__builtin_cpu_supports("sse2")) {
+                return Isa::Sse;
+            }
+#endif
+            return Isa::Scalar;
+        }
+
+        void initialize() {
+            initialize(detectIsa());
+        }
+
+        void initialize(Isa isa) {
+            active = makeKernels<0>(isa);
+            for (int n = 0; n <= MaxSizedKernel; ++n) {
+                sized[n] = &active;
+            }
+
+            // embedding sizes and the 3x wide feature vectors built from them
+            specialize<100>(isa, 0);
+            specialize<128>(isa, 1);
+            specialize<200>(isa, 2);
+            specialize<256>(isa, 3);
+            specialize<300>(isa, 4);
+            specialize<384>(isa, 5);
+            specialize<600>(isa, 6);
+            specialize<768>(isa, 7);
+            specialize<900>(isa, 8);
+        }
+
+        const char* isaName(Isa isa) {
+            switch (isa) {
+                case Isa::Avx512:
+                    return "avx512";
+                case Isa::Avx2:
+                    return "avx2";
+                case Isa::Sse:
+                    return "sse";
+                default:
+                    return "scalar";
+            }
+        }
+
+        Precision parsePrecision(const std::string& name) {
+            if (name == "fp32") {
+                return Precision::Fp32;
+            } else if (name == "bf16") {
+                return Precision::Bf16;
+            } else if (name == "fp16") {
+                return Precision::Fp16;
+            }
+            throw std::runtime_error("Unknown precision: " + name);
+        }
+
+        const char* precisionName(Precision precision) {
+            switch (precision) {
+                case Precision::Bf16:
+                    return "bf16";
+                case Precision::Fp16:
+                    return "fp16";
+                default:
+                    return "fp32";
+            }
+        }
+
+        void setStochasticRounding(bool enabled) {
+            stochasticRounding = enabled;
+        }
+
+        void seedRounding(uint32_t seed) {
+            roundingState = seed != 0 ? seed : 495;
+        }
+
+        uint32_t roundingSeed() {
+            return roundingState;
+        }
+
+        // Half precision operands are widened chunk by chunk into stack buffers
+        // so that the fp32 kernels do the arithmetic.
+        const int ConvertChunkSize = 1024;
+
+        void convert(void* y, Precision py, const void* x, Precision px, int n) {
+            if (px == py) {
+                std::memcpy(y, x, (size_t)n * precisionSize(px));
+            } else if (py == Precision::Fp32) {
+                active.widen((float*)y, (const uint16_t*)x, n, px);
+            } else if (px == Precision::Fp32) {
+                active.narrow((uint16_t*)y, (const float*)x, n, py);
+            } else {
+                alignas(64) float buffer[ConvertChunkSize];
+                for (int i = 0; i < n; i += ConvertChunkSize) {
+                    int m = std::min(ConvertChunkSize, n - i);
+                    active.widen(buffer, (const uint16_t*)x + i, m, px);
+                    active.narrow((uint16_t*)y + i, buffer, m, py);
+                }
+            }
+        }
+
+        float dotWidened(const void* x, Precision px, const void* y, Precision py, int n) {
+            alignas(64) float bufferX[ConvertChunkSize];
+            alignas(64) float bufferY[ConvertChunkSize];
+            float sum = 0.0f;
+            for (int i = 0; i < n; i += ConvertChunkSize) {
+                int m = std::min(ConvertChunkSize, n - i);
+                const float* fx = (const float*)x + i;
+                const float* fy = (const float*)y + i;
+                if (px != Precision::Fp32) {
+                    active.widen(bufferX, (const uint16_t*)x + i, m, px);
+                    fx = bufferX;
+                }
+                if (py != Precision::Fp32) {
+                    active.widen(bufferY, (const uint16_t*)y + i, m, py);
+                    fy = bufferY;
+                }
+                sum += dot(fx, fy, m);
+            }
+            return sum;
+        }
+
+        void axpyWidened(void* y, Precision py, const void* x, Precision px, float a, int n) {
+            alignas(64) float bufferX[ConvertChunkSize];
+            alignas(64) float bufferY[ConvertChunkSize];
+            for (int i = 0; i < n; i += ConvertChunkSize) {
+                int m = std::min(ConvertChunkSize, n - i);
+                const float* fx = (const float*)x + i;
+                float* fy = (float*)y + i;
+                if (px != Precision::Fp32) {
+                    active.widen(bufferX, (const uint16_t*)x + i, m, px);
+                    fx = bufferX;
+                }
+                if (py != Precision::Fp32) {
+                    active.widen(bufferY, (const uint16_t*)y + i, m, py);
+                    fy = bufferY;
+                }
+                axpy(fy, fx, a, m);
+                if (py != Precision::Fp32) {
+                    active.narrow((uint16_t*)y + i, bufferY, m, py);
+                }
+            }
+        }
+
+    }
+
+}
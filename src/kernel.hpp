@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace sv4d {
+
+    namespace kernel {
+
+        // Element type of a weight row. Half precision rows are widened to
+        // fp32 inside the kernels and rounded back when they are updated.
+        enum Precision {
+            Fp32 = 0,
+            Bf16 = 1,
+            Fp16 = 2,
+        };
+
+        enum Isa {
+            Scalar = 0,
+            Sse = 1,
+            Avx2 = 2,
+            Avx512 = 3,
+        };
+
+        struct Kernels {
+            Isa isa;
+            float (*dot)(const float* x, const float* y, int n);
+            void (*axpy)(float* y, const float* x, float a, int n);
+            void (*scale)(float* x, float a, int n);
+            void (*softmax)(const float* x, int n, float temperature, float* y, float* z);
+            void (*sigmoid)(const float* x, float* y, int n);
+            void (*widen)(float* y, const uint16_t* x, int n, Precision precision);
+            void (*narrow)(uint16_t* y, const float* x, int n, Precision precision);
+            int32_t (*dotInt8)(const int8_t* x, const int8_t* y, int n);
+            void (*gemmNT)(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc);
+            void (*gemmNN)(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc);
+            void (*gemmTN)(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc);
+        };
+
+        const int MaxSizedKernel = 1024;
+
+        // Kernels selected at startup; scalar until initialize() is called.
+        // sized[n] points to kernels with the trip count fixed to n for the
+        // common embedding sizes, and to the generic kernels otherwise.
+        extern Kernels active;
+        extern const Kernels* sized[MaxSizedKernel + 1];
+
+        Isa detectIsa();
+        void initialize();
+        void initialize(Isa isa);
+        const char* isaName(Isa isa);
+
+        Precision parsePrecision(const std::string& name);
+        const char* precisionName(Precision precision);
+
+        inline int precisionSize(Precision precision) {
+            return precision == Precision::Fp32 ? 4 : 2;
+        }
+
+        // Stochastic rounding of bf16 updates, with a per-thread random state.
+        void setStochasticRounding(bool enabled);
+        void seedRounding(uint32_t seed);
+        // Current state of the calling thread; seedRounding() with it
+        // continues the same sequence.
+        uint32_t roundingSeed();
+
+        inline const Kernels& select(int n) {
+            if (n <= MaxSizedKernel && sized[n] != nullptr) {
+                return *sized[n];
+            }
+            return active;
+        }
+
+        // x' * y
+        inline float dot(const float* x, const float* y, int n) {
+            return select(n).dot(x, y, n);
+        }
+
+        // y += a * x
+        inline void axpy(float* y, const float* x, float a, int n) {
+            select(n).axpy(y, x, a, n);
+        }
+
+        // x *= a
+        inline void scale(float* x, float a, int n) {
+            select(n).scale(x, a, n);
+        }
+
+        // y = softmax(x / temperature) and, unless z is null, z = softmax(x)
+        inline void softmax(const float* x, int n, float temperature, float* y, float* z) {
+            active.softmax(x, n, temperature, y, z);
+        }
+
+        // x' * y over int8 rows, accumulated exactly in int32; values must lie
+        // in [-127, 127]
+        inline int32_t dotInt8(const int8_t* x, const int8_t* y, int n) {
+            return active.dotInt8(x, y, n);
+        }
+
+        // y = sigmoid(x) elementwise, for a block of scores at once
+        inline void sigmoid(const float* x, float* y, int n) {
+            active.sigmoid(x, y, n);
+        }
+
+        // Products of small row-major fp32 blocks that stay in cache, computed
+        // in register tiles over blocks of columns. Leading dimensions are in
+        // floats.
+        //   gemmNT: C[m x n] = A[m x k] * B[n x k]'
+        //   gemmNN: C[m x k] += A[m x n] * B[n x k]
+        //   gemmTN: C[n x k] += A[m x n]' * B[m x k]
+        inline void gemmNT(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc) {
+            active.gemmNT(m, n, k, a, lda, b, ldb, c, ldc);
+        }
+
+        inline void gemmNN(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc) {
+            active.gemmNN(m, n, k, a, lda, b, ldb, c, ldc);
+        }
+
+        inline void gemmTN(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc) {
+            active.gemmTN(m, n, k, a, lda, b, ldb, c, ldc);
+        }
+
+        // y = x, converting between precisions
+        void convert(void* y, Precision py, const void* x, Precision px, int n);
+
+        float dotWidened(const void* x, Precision px, const void* y, Precision py, int n);
+        void axpyWidened(void* y, Precision py, const void* x, Precision px, float a, int n);
+
+        // x' * y for rows of any precision
+        inline float dotMixed(const void* x, Precision px, const void* y, Precision py, int n) {
+            if (px == Precision::Fp32 && py == Precision::Fp32) {
+                return dot((const float*)x, (const float*)y, n);
+            }
+            return dotWidened(x, px, y, py, n);
+        }
+
+        // y += a * x for rows of any precision
+        inline void axpyMixed(void* y, Precision py, const void* x, Precision px, float a, int n) {
+            if (px == Precision::Fp32 && py == Precision::Fp32) {
+                axpy((float*)y, (const float*)x, a, n);
+            } else {
+                axpyWidened(y, py, x, px, a, n);
+            }
+        }
+
+    }
+
+}
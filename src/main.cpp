@@ -1,8 +1,11 @@
 #include "options.hpp"
 #include "vocab.hpp"
 #include "model.hpp"
+#include "kernel.hpp"
+#include "corpus.hpp"
 
 #include <iostream>
+#include <stdio.h>
 // #include <fenv.h>
 
 void printUsage() {
@@ -10,6 +13,7 @@ void printUsage() {
         << "usage: sv4d <command> <options>\n\n"
         << "The commands supported by sv4d are:\n\n"
         << "  training                  train a sense vector and wsd module\n"
+        << "  compile_corpus            convert the training corpus into a binary corpus\n"
         << "  word_nearest_neighbour    query for word nearest neighbour\n"
         << "  synset_nearest_neighbour  query for synset nearest neighbour\n"
         << std::endl;
@@ -22,6 +26,7 @@ void printOptionsHelp() {
         << "  -model_dir                whether model should be saved [" << options.modelDir << "]\n"
         << "  -synset_data_file         model vocabulary file with dictionary pair [" << options.synsetDataFile << "]\n"
         << "  -training_corpus          training corpus file path [" << options.synsetDataFile << "]\n"
+        << "  -compiled_corpus          binary corpus written by compile_corpus and read by training [" << options.compiledCorpus << "]\n"
         << "  -stop_words_file          stop words file path [" << options.stopWordsFile << "]\n"
         << "  -epoch                    number of epochs [" << options.epochs << "]\n"
         << "  -embedding_layer_size     size of vectors [" << options.embeddingLayerSize << "]\n"
@@ -32,6 +37,9 @@ void printOptionsHelp() {
         << "  -dict_sample              number of dictionary pairs sampled per word [" << options.dictSample << "]\n"
         << "  -max_dict_pair            number of dictionary pairs used [" << options.maxDictPair << "]\n"
         << "  -thread_num               number of threads [" << options.threadNum << "]\n"
+        << "  -reader_thread_num        threads reading batches for the training threads, 0 to read inline; a quarter of -thread_num unless given [" << options.readerThreadNum << "]\n"
+        << "  -queue_size               batches queued per reader thread [" << options.queueSize << "]\n"
+        << "  -chunks_per_thread        document-aligned corpus chunks per reading thread, shuffled each epoch [" << options.chunksPerThread << "]\n"
         << "  -sub_sampling_factor      threshold for occurrence of words [" << options.subSamplingFactor << "]\n"
         << "  -initial_learning_rate    initial learning rate [" << options.initialLearningRate << "]\n"
         << "  -min_learning_rate        min learning rate [" << options.minLearningRate << "]\n"
@@ -39,6 +47,28 @@ void printOptionsHelp() {
         << "  -min_temperature          min softmaxs temperature [" << options.minTemperature << "]\n"
         << "  -beta_dict                beta dict [" << options.betaDict << "]\n"
         << "  -beta_reward              beta reward [" << options.betaReward << "]\n"
+        << "  -shared_negative          train all senses and the word against one negative set per position [" << options.sharedNegative << "]\n"
+        << "  -incremental_context      slide context and document window sums instead of re-summing them [" << options.incrementalContext << "]\n"
+        << "  -context_recompute_interval  positions between exact recomputes of the sliding sums [" << options.contextRecomputeInterval << "]\n"
+        << "  -checkpoint_words         write a checkpoint to the model directory every N trained words (0: never) [" << options.checkpointWords << "]\n"
+        << "  -checkpoint_minutes       write a checkpoint to the model directory every N minutes (0: never) [" << options.checkpointMinutes << "]\n"
+        << "  -snapshot_words           write the weights to <model_dir>/snapshot_<words> every N trained words in the background (0: never) [" << options.snapshotWords << "]\n"
+        << "  -snapshot_minutes         write the weights to <model_dir>/snapshot_<words> every N minutes in the background (0: never) [" << options.snapshotMinutes << "]\n"
+        << "  -telemetry                export per-thread counters and phase times to the model directory: off, json (telemetry.jsonl) or prometheus (telemetry.prom) [" << options.telemetry << "]\n"
+        << "  -telemetry_seconds        seconds between telemetry exports [" << options.telemetrySeconds << "]\n"
+        << "  -resume                   continue training from the checkpoint and vocab in the model directory [" << options.resume << "]\n"
+        << "  -negative_sampler         negative sampling from an alias table or the 1e8-entry unigram table: alias or table [" << options.negativeSampler << "]\n"
+        << "  -hot_rows                 output rows of the most frequent words each thread trains in a private copy (0: off) [" << options.hotRows << "]\n"
+        << "  -hot_row_sync             trained positions between merges of the private rows into the shared weights [" << options.hotRowSync << "]\n"
+        << "  -deterministic            bit-identical weights for a given corpus and thread number, training in rounds with inline reading [" << options.deterministic << "]\n"
+        << "  -cached_reward            compute sense-selection reward dots once per sentence as block products [" << options.cachedReward << "]\n"
+        << "  -sigmoid_table_size       entries of the sigmoid lookup table [" << options.sigmoidTableSize << "]\n"
+        << "  -storage_precision        weight storage for training: fp32, bf16 or fp16 [" << options.storagePrecision << "]\n"
+        << "  -stochastic_rounding      round bf16 weight updates stochastically [" << options.stochasticRounding << "]\n"
+        << "  -numa                     placement of weights and unigram table: off, local or interleave [" << options.numa << "]\n"
+        << "  -huge_pages               2MB pages for weights and unigram table: off, transparent or explicit [" << options.hugePages << "]\n"
+        << "  -quantize_neighbour       scan int8 quantized vectors in nearest neighbour queries [" << options.quantizeNeighbour << "]\n"
+        << "  -rerank_size              candidates reranked exactly after a quantized scan [" << options.rerankSize << "]\n"
         << std::endl;
 }
 
@@ -65,20 +95,30 @@ int main(int argc, char** argv) {
         }
     }
 
+    sv4d::kernel::initialize();
+    printf("SIMD: %s  \n", sv4d::kernel::isaName(sv4d::kernel::active.isa));
+
     std::string command(args[1]);
     if (command == "training") {
         sv4d::Vocab vocab = sv4d::Vocab();
         try {
-            vocab.build(opt);
-            vocab.save(opt.modelDir + "vocab.txt");
+            if (opt.resume) {
+                vocab.load(opt.modelDir + "vocab.txt");
+            } else {
+                vocab.build(opt);
+                vocab.save(opt.modelDir + "vocab.txt");
+            }
         } catch (const std::exception& e) {
             std::cerr << e.what() << '\n';
             exit(EXIT_FAILURE);
         }
 
-        sv4d::Model model = sv4d::Model(opt, vocab);
+        sv4d::Model model(opt, vocab);
         try {
             model.initialize();
+            if (opt.resume) {
+                model.loadCheckpoint(opt.modelDir + "checkpoint");
+            }
             model.training();
             model.saveEmbeddingInWeight(opt.modelDir + "embedding_in_weight", opt.binary);
             model.saveEmbeddingOutWeight(opt.modelDir + "embedding_out_weight", opt.binary);
@@ -88,6 +128,17 @@ int main(int argc, char** argv) {
             std::cerr << e.what() << '\n';
             exit(EXIT_FAILURE);
         }
+    } else if (command == "compile_corpus") {
+        if (opt.compiledCorpus == "") {
+            std::cerr << "compile_corpus requires -compiled_corpus" << '\n';
+            exit(EXIT_FAILURE);
+        }
+        try {
+            sv4d::compileCorpus(opt.trainingCorpus, opt.compiledCorpus);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << '\n';
+            exit(EXIT_FAILURE);
+        }
     } else if (command == "word_nearest_neighbour") {
         sv4d::Vocab vocab = sv4d::Vocab();
         try {
@@ -97,7 +148,7 @@ int main(int argc, char** argv) {
             exit(EXIT_FAILURE);
         }
 
-        sv4d::Model model = sv4d::Model(opt, vocab);
+        sv4d::Model model(opt, vocab);
         try {
             model.loadEmbeddingInWeight(opt.modelDir + "embedding_in_weight", opt.binary);
             model.wordNearestNeighbour();
@@ -114,7 +165,7 @@ int main(int argc, char** argv) {
             exit(EXIT_FAILURE);
         }
 
-        sv4d::Model model = sv4d::Model(opt, vocab);
+        sv4d::Model model(opt, vocab);
         try {
             model.loadEmbeddingInWeight(opt.modelDir + "embedding_in_weight", opt.binary);
             model.synsetNearestNeighbour();
@@ -1,29 +1,181 @@
 #include "matrix.hpp"
 
 #include "vector.hpp"
+#include "kernel.hpp"
+#include "utils.hpp"
 #include <vector>
 #include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
 
 namespace sv4d {
 
     Matrix::Matrix() : Matrix(0, 0) {}
 
-    Matrix::Matrix(int m, int n) : data(m, sv4d::Vector(n)), row(m), col(n) {}
+    Matrix::Matrix(int m, int n) : Matrix(m, n, sv4d::kernel::Precision::Fp32) {}
 
-    void Matrix::setZero() {
-        for (auto& x : data) {
-            x.setZero();
+    Matrix::Matrix(int m, int n, sv4d::kernel::Precision precision) : row(m), col(n), precision(precision) {
+        size_t elementSize = sv4d::kernel::precisionSize(precision);
+        rowBytes = bytes(1, n, precision);
+        stride = rowBytes / elementSize;
+        data = sv4d::utils::memory::largeAlloc(bytes());
+    }
+
+    Matrix::Matrix(const sv4d::Matrix& matrix) : Matrix(matrix.row, matrix.col, matrix.precision) {
+        std::memcpy(data, matrix.data, bytes());
+    }
+
+    Matrix::Matrix(sv4d::Matrix&& matrix) : data(matrix.data), row(matrix.row), col(matrix.col), stride(matrix.stride), rowBytes(matrix.rowBytes), precision(matrix.precision) {
+        matrix.data = nullptr;
+        matrix.row = 0;
+        matrix.col = 0;
+        matrix.stride = 0;
+        matrix.rowBytes = 0;
+    }
+
+    Matrix::~Matrix() {
+        sv4d::utils::memory::largeFree(data, bytes());
+    }
+
+    sv4d::Matrix& Matrix::operator=(const sv4d::Matrix& matrix) {
+        if (this != &matrix) {
+            sv4d::Matrix copy(matrix);
+            *this = std::move(copy);
         }
+        return *this;
+    }
+
+    sv4d::Matrix& Matrix::operator=(sv4d::Matrix&& matrix) {
+        std::swap(data, matrix.data);
+        std::swap(row, matrix.row);
+        std::swap(col, matrix.col);
+        std::swap(stride, matrix.stride);
+        std::swap(rowBytes, matrix.rowBytes);
+        std::swap(precision, matrix.precision);
+        return *this;
+    }
+
+    size_t Matrix::bytes() const {
+        return rowBytes * row;
+    }
+
+    size_t Matrix::bytes(int m, int n, sv4d::kernel::Precision precision) {
+        return sv4d::utils::memory::alignedSize((size_t)sv4d::kernel::precisionSize(precision) * n) * m;
+    }
+
+    void Matrix::setZero() {
+        std::memset(data, 0, bytes());
     }
     
     void Matrix::setRandomUniform(float min, float max) {
         std::mt19937 mt(495);
         std::uniform_real_distribution<float> r(min, max);
+        sv4d::Vector rowBuffer(col);
         for (int i = 0; i < row; ++i) {
             for (int j = 0; j < col; j++) {
-                data[i][j] = r(mt);
+                rowBuffer[j] = r(mt);
             }
+            (*this)[i].assign(rowBuffer);
+        }
+    }
+
+    QuantizedMatrix::QuantizedMatrix() : QuantizedMatrix(0, 0) {}
+
+    QuantizedMatrix::QuantizedMatrix(int m, int n) : row(m), col(n), scales(m, 0.0f) {
+        rowBytes = sv4d::utils::memory::alignedSize(n);
+        data = (int8_t*)sv4d::utils::memory::alignedAlloc(bytes() > 0 ? bytes() : 1);
+        std::memset(data, 0, bytes());
+    }
+
+    QuantizedMatrix::QuantizedMatrix(const sv4d::QuantizedMatrix& matrix) : QuantizedMatrix(matrix.row, matrix.col) {
+        std::memcpy(data, matrix.data, bytes());
+        scales = matrix.scales;
+    }
+
+    QuantizedMatrix::QuantizedMatrix(sv4d::QuantizedMatrix&& matrix) : data(matrix.data), row(matrix.row), col(matrix.col), rowBytes(matrix.rowBytes), scales(std::move(matrix.scales)) {
+        matrix.data = nullptr;
+        matrix.row = 0;
+        matrix.col = 0;
+        matrix.rowBytes = 0;
+    }
+
+    QuantizedMatrix::~QuantizedMatrix() {
+        sv4d::utils::memory::alignedFree(data);
+    }
+
+    sv4d::QuantizedMatrix& QuantizedMatrix::operator=(const sv4d::QuantizedMatrix& matrix) {
+        if (this != &matrix) {
+            sv4d::QuantizedMatrix copy(matrix);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    sv4d::QuantizedMatrix& QuantizedMatrix::operator=(sv4d::QuantizedMatrix&& matrix) {
+        std::swap(data, matrix.data);
+        std::swap(row, matrix.row);
+        std::swap(col, matrix.col);
+        std::swap(rowBytes, matrix.rowBytes);
+        std::swap(scales, matrix.scales);
+        return *this;
+    }
+
+    size_t QuantizedMatrix::bytes() const {
+        return rowBytes * row;
+    }
+
+    void QuantizedMatrix::quantize(int idx, const sv4d::VectorView& vector) {
+        float max = 0.0f;
+        for (int i = 0; i < col; ++i) {
+            max = std::max(max, std::abs(vector.data[i]));
+        }
+        int8_t* rowData = (*this)[idx];
+        if (!(max > 0.0f) || !std::isfinite(max)) {
+            std::memset(rowData, 0, col);
+            scales[idx] = 0.0f;
+            return;
+        }
+        float inverseScale = 127.0f / max;
+        for (int i = 0; i < col; ++i) {
+            long value = std::lrint(vector.data[i] * inverseScale);
+            rowData[i] = (int8_t)std::max(-127L, std::min(127L, value));
+        }
+        scales[idx] = max / 127.0f;
+    }
+
+    RowCopies::RowCopies() : RowCopies(0, 0) {}
+
+    RowCopies::RowCopies(int rowNum, int col) : col(col), slots(rowNum, -1) {}
+
+    sv4d::VectorView RowCopies::get(int idx, const sv4d::VectorView& shared) {
+        int slot = slots[idx];
+        if (slot == -1) {
+            slot = rows.size();
+            if (slot / BlockRows == (int)copies.size()) {
+                copies.push_back(sv4d::Matrix(BlockRows, col));
+                bases.push_back(sv4d::Matrix(BlockRows, col));
+            }
+            copy(slot).assign(shared);
+            bases[slot / BlockRows][slot % BlockRows].assign(copy(slot));
+            slots[idx] = slot;
+            rows.push_back(idx);
+        }
+        return copy(slot);
+    }
+
+    void RowCopies::takeDeltas() {
+        for (size_t k = 0; k < rows.size(); ++k) {
+            copy(k) -= bases[k / BlockRows][k % BlockRows];
+        }
+    }
+
+    void RowCopies::clear() {
+        for (int idx : rows) {
+            slots[idx] = -1;
         }
+        rows.clear();
     }
 
-}
\ No newline at end of file
+}
@@ -1,29 +1,135 @@
 #pragma once
 
 #include "vector.hpp"
+#include "kernel.hpp"
 #include <vector>
+#include <cstddef>
+#include <cstdint>
 
 namespace sv4d {
 
+    // Row-major matrix stored in a single aligned slab. Each row starts on an
+    // Alignment boundary; rows are accessed through non-owning views. Rows
+    // are stored as fp32, bf16 or fp16 depending on precision. The slab comes
+    // from utils::memory::largeAlloc and follows its page placement.
     class Matrix {
         public:
             Matrix();
             Matrix(int m, int n);
+            Matrix(int m, int n, sv4d::kernel::Precision precision);
+            Matrix(const sv4d::Matrix& matrix);
+            Matrix(sv4d::Matrix&& matrix);
+            ~Matrix();
 
-            std::vector<sv4d::Vector> data;
+            sv4d::Matrix& operator=(const sv4d::Matrix& matrix);
+            sv4d::Matrix& operator=(sv4d::Matrix&& matrix);
+
+            void* data;
             int row;
             int col;
+            int stride;
+            size_t rowBytes;
+            sv4d::kernel::Precision precision;
+
+            size_t bytes() const;
+
+            static size_t bytes(int m, int n, sv4d::kernel::Precision precision);
 
             void setZero();
             void setRandomUniform(float min, float max);
 
-            inline sv4d::Vector& operator[](int idx) {
-                return data[idx];
+            inline sv4d::VectorView operator[](int idx) {
+                return sv4d::VectorView((char*)data + idx * rowBytes, col, precision);
+            }
+
+            inline const sv4d::VectorView operator[](int idx) const {
+                return sv4d::VectorView((char*)data + idx * rowBytes, col, precision);
+            }
+    };
+
+    // Row-major int8 matrix with one fp32 scale per row, so that row i
+    // approximates scales[i] * (*this)[i]. Rows are quantized symmetrically
+    // to [-127, 127] and laid out on Alignment boundaries like Matrix rows.
+    class QuantizedMatrix {
+        public:
+            QuantizedMatrix();
+            QuantizedMatrix(int m, int n);
+            QuantizedMatrix(const sv4d::QuantizedMatrix& matrix);
+            QuantizedMatrix(sv4d::QuantizedMatrix&& matrix);
+            ~QuantizedMatrix();
+
+            sv4d::QuantizedMatrix& operator=(const sv4d::QuantizedMatrix& matrix);
+            sv4d::QuantizedMatrix& operator=(sv4d::QuantizedMatrix&& matrix);
+
+            int8_t* data;
+            int row;
+            int col;
+            size_t rowBytes;
+            std::vector<float> scales;
+
+            size_t bytes() const;
+
+            // Quantizes an fp32 vector into row idx.
+            void quantize(int idx, const sv4d::VectorView& vector);
+
+            // Approximate dot product of rows i and j.
+            inline float dot(int i, int j) const {
+                return scales[i] * scales[j] * sv4d::kernel::dotInt8((*this)[i], (*this)[j], col);
             }
 
-            inline const sv4d::Vector& operator[](int idx) const {
-                return data[idx];
+            inline int8_t* operator[](int idx) {
+                return data + idx * rowBytes;
+            }
+
+            inline const int8_t* operator[](int idx) const {
+                return data + idx * rowBytes;
+            }
+    };
+
+    // Private fp32 copies of rows of shared weights, for a thread that should
+    // not write the shared rows while it trains. A row is copied on its first
+    // access after clear(), and copies do not move until then. The changes
+    // of the copies are added back with takeDeltas() and addDeltas().
+    class RowCopies {
+        public:
+            RowCopies();
+            RowCopies(int rowNum, int col);
+
+            // rows with a copy, in order of first access
+            std::vector<int> rows;
+
+            // The copy of row idx, taken from shared on first access.
+            sv4d::VectorView get(int idx, const sv4d::VectorView& shared);
+
+            // Turns every copy into its change since it was taken.
+            void takeDeltas();
+
+            // Adds the changes of rows idx with idx % partitionNum ==
+            // partition to sharedRow(idx), in order of first access.
+            template <class SharedRow>
+            void addDeltas(SharedRow sharedRow, int partition, int partitionNum) {
+                for (size_t k = 0; k < rows.size(); ++k) {
+                    if (rows[k] % partitionNum == partition) {
+                        sv4d::VectorView shared = sharedRow(rows[k]);
+                        shared += copy(k);
+                    }
+                }
+            }
+
+            void clear();
+
+        private:
+            static const int BlockRows = 256;
+
+            int col;
+            // slot of each row's copy, -1 without one
+            std::vector<int> slots;
+            std::vector<sv4d::Matrix> copies;
+            std::vector<sv4d::Matrix> bases;
+
+            inline sv4d::VectorView copy(int slot) {
+                return copies[slot / BlockRows][slot % BlockRows];
             }
     };
 
-}
\ No newline at end of file
+}
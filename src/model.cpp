@@ -5,7 +5,12 @@
 #include "matrix.hpp"
 #include "vector.hpp"
 #include "utils.hpp"
+#include "kernel.hpp"
+#include "corpus.hpp"
+#include "pipeline.hpp"
+#include "telemetry.hpp"
 #include <vector>
+#include <memory>
 #include <algorithm>
 #include <thread>
 #include <fstream>
@@ -14,17 +19,40 @@
 #include <cmath>
 #include <utility>
 #include <deque>
-#include <unordered_set>
 #include <limits>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <stdio.h>
 
 namespace sv4d {
 
+    // checkpoint format, with its version in the last byte
+    static const char CheckpointMagic[8] = {'s', 'v', '4', 'd', 'c', 'k', 'p', '2'};
+
+    // output buffer of the background writer
+    static const size_t BackgroundWriteBufferSize = 1 << 20;
+    // a background write still running is reported this often
+    static const int BackgroundWriteWarningSeconds = 60;
+
     Model::Model(const sv4d::Options& opt, const sv4d::Vocab& v) {
         vocab = v;
 
         trainingCorpus = opt.trainingCorpus;
+        compiledCorpus = opt.compiledCorpus;
         stopWordsFile = opt.stopWordsFile;
+        modelDir = opt.modelDir;
+        checkpointFile = opt.modelDir + "checkpoint";
 
         epochs = opt.epochs;
         embeddingLayerSize = opt.embeddingLayerSize;
@@ -35,7 +63,16 @@ namespace sv4d {
         maxDictPair = opt.maxDictPair;
         threadNum = opt.threadNum;
         batchSize = opt.batchSize;
-        fileSize = 0;
+        readerThreadNum = opt.readerThreadNum;
+        queueSize = opt.queueSize;
+        chunksPerThread = opt.chunksPerThread;
+        checkpointWords = opt.checkpointWords;
+        checkpointMinutes = opt.checkpointMinutes;
+        snapshotWords = opt.snapshotWords;
+        snapshotMinutes = opt.snapshotMinutes;
+        telemetry = opt.telemetry;
+        telemetrySeconds = opt.telemetrySeconds;
+        binary = opt.binary;
 
         subSamplingFactor = opt.subSamplingFactor;
         initialLearningRate = opt.initialLearningRate;
@@ -44,53 +81,200 @@ namespace sv4d {
         minTemperature = opt.minTemperature;
         betaDict = opt.betaDict;
         betaReward = opt.betaReward;
+
+        sv4d::utils::memory::setPlacement(sv4d::utils::memory::parseNumaPolicy(opt.numa), sv4d::utils::memory::parseHugePages(opt.hugePages), threadNum);
+
+        storagePrecision = sv4d::kernel::parsePrecision(opt.storagePrecision);
+        stochasticRounding = opt.stochasticRounding;
+        sharedNegative = opt.sharedNegative;
+        negativeSampler = opt.negativeSampler;
+        incrementalContext = opt.incrementalContext;
+        contextRecomputeInterval = opt.contextRecomputeInterval;
+        hotRows = opt.hotRows;
+        hotRowSync = opt.hotRowSync;
+        deterministic = opt.deterministic;
+        if (deterministic) {
+            // batches are read by the training threads, in rounds
+            readerThreadNum = 0;
+        }
+        cachedReward = opt.cachedReward;
+        quantizeNeighbour = opt.quantizeNeighbour;
+        rerankSize = opt.rerankSize;
+        sigmoidTableSize = opt.sigmoidTableSize;
         
-        senseSelectionOutWeight = sv4d::Matrix(vocab.lemmaVocabSize, embeddingLayerSize * 3);
+        senseSelectionOutWeight = sv4d::Matrix(vocab.lemmaVocabSize, embeddingLayerSize * 3, storagePrecision);
         senseSelectionOutBias = sv4d::Vector(vocab.lemmaVocabSize);
-        embeddingInWeight = sv4d::Matrix(vocab.synsetVocabSize, embeddingLayerSize);
-        embeddingOutWeight = sv4d::Matrix(vocab.wordVocabSize, embeddingLayerSize);
+        embeddingInWeight = sv4d::Matrix(vocab.synsetVocabSize, embeddingLayerSize, storagePrecision);
+        embeddingOutWeight = sv4d::Matrix(vocab.wordVocabSize, embeddingLayerSize, storagePrecision);
 
-        unigramTable = std::vector<int>();
+        unigramTable = std::vector<int, sv4d::utils::memory::LargeAllocator<int>>();
         subsamplingFactorTable = std::vector<float>();
-        stopWords = std::unordered_set<int>();
+        stopWords = std::vector<bool>();
 
         trainedWordCount = 0;
+        startWordCount = 0;
+        finishedTrainerNum = 0;
+        backgroundWrite.buffer.resize(BackgroundWriteBufferSize);
+        backgroundWrite.row = sv4d::Vector(embeddingLayerSize * 3);
+        backgroundWriter = 0;
+        backgroundWriterWarnings = 0;
+    }
+
+    Model::TrainerState::TrainerState(int threadId, int synsetVocabSize, float lr, float temp) : mt(495 + threadId), negativeRandom(495 + threadId), roundingSeed(495 + threadId), lr(lr), temp(temp), dictPairPos(synsetVocabSize) {
+        // initialize negative sampling position
+        negativePos = mt() % UnigramTableSize + 1;
     }
 
+    Model::RoundCopies::RoundCopies(const sv4d::Vocab& vocab, int embeddingLayerSize) : senseSelectionOut(vocab.lemmaVocabSize, embeddingLayerSize * 3), senseSelectionBias(vocab.lemmaVocabSize, 1), embeddingIn(vocab.synsetVocabSize, embeddingLayerSize), embeddingOut(vocab.wordVocabSize, embeddingLayerSize) {}
+
     void Model::initialize() {
+        sv4d::utils::operation::setSigmoidTableSize(sigmoidTableSize);
         initializeWeight();
-        initializeUnigramTable();
+        initializeNegativeSampler();
         initializeSubsamplingFactorTable();
-        initializeFileSize();
         initializeStopWords();
+        compiledVocab = vocab.compile();
     }
 
     void Model::training() {
         startTime = std::chrono::system_clock::now();
-        trainedWordCount = 0;
         printf("Training model:  \n");
-        if (threadNum > 1) {
-            auto threads = std::vector<std::thread>();
-            for (int i = 0; i < threadNum; i++) {
-                threads.push_back(std::thread(&Model::trainingThread, this, i));
+
+        // reader threads feed the trainers through the pipeline; without
+        // them every trainer reads chunks itself
+        int workerNum = readerThreadNum > 0 ? readerThreadNum : threadNum;
+        if (!scheduler) {
+            trainedWordCount = 0;
+            auto chunks = sv4d::openCorpusReader(trainingCorpus, compiledCorpus, vocab)->split(workerNum * chunksPerThread);
+            scheduler = std::unique_ptr<sv4d::ChunkScheduler>(new sv4d::ChunkScheduler(chunks, workerNum, epochs, !deterministic));
+        }
+        startWordCount = trainedWordCount;
+        printf("Chunks: %d  \n", (int)scheduler->getChunks().size());
+
+        // per-thread state, continued from a checkpoint where there is one
+        if ((!readerRandoms.empty() && (int)readerRandoms.size() != workerNum) || (!trainerStates.empty() && (int)trainerStates.size() != threadNum)) {
+            printf("Checkpoint was written with other thread numbers; resume is not exact  \n");
+        }
+        batchReaders.clear();
+        for (int i = 0; i < workerNum; ++i) {
+            batchReaders.push_back(std::unique_ptr<sv4d::BatchReader>(new sv4d::BatchReader(sv4d::openCorpusReader(trainingCorpus, compiledCorpus, vocab), scheduler.get(), i)));
+            if (i < (int)readerRandoms.size()) {
+                batchReaders[i]->mt = readerRandoms[i];
             }
+        }
+        trainerStates.resize(std::min((int)trainerStates.size(), threadNum));
+        for (int i = trainerStates.size(); i < threadNum; ++i) {
+            trainerStates.push_back(std::unique_ptr<TrainerState>(new TrainerState(i, vocab.synsetVocabSize, initialLearningRate, initialTemperature)));
+        }
+        finishedTrainerNum = 0;
+        trainerCounters.clear();
+        for (int i = 0; i < threadNum; ++i) {
+            trainerCounters.push_back(std::unique_ptr<sv4d::telemetry::ThreadCounters>(new sv4d::telemetry::ThreadCounters()));
+        }
+        roundCopies.clear();
+        if (deterministic) {
+            roundBarrier = std::unique_ptr<sv4d::Barrier>(new sv4d::Barrier(threadNum));
+            for (int i = 0; i < threadNum; ++i) {
+                roundCopies.push_back(std::unique_ptr<RoundCopies>(new RoundCopies(vocab, embeddingLayerSize)));
+            }
+        }
+
+        bool checkpointing = checkpointWords > 0 || checkpointMinutes > 0;
+        bool snapshotting = snapshotWords > 0 || snapshotMinutes > 0;
+        auto pipeline = std::unique_ptr<sv4d::Pipeline>();
+        auto threads = std::vector<std::thread>();
+        if (readerThreadNum > 0) {
+            pipeline = std::unique_ptr<sv4d::Pipeline>(new sv4d::Pipeline(readerThreadNum, queueSize));
+            for (int i = 0; i < readerThreadNum; i++) {
+                threads.push_back(std::thread(&Model::readerThread, this, i, pipeline.get(), batchReaders[i].get()));
+            }
+        }
+        auto reporter = std::thread(&Model::reporterThread, this, pipeline.get());
+        if (threadNum > 1 || checkpointing || snapshotting) {
             for (int i = 0; i < threadNum; i++) {
-                threads[i].join();
+                threads.push_back(std::thread(&Model::trainingThread, this, i, pipeline.get(), pipeline ? nullptr : batchReaders[i].get()));
             }
         } else {
-            Model::trainingThread(0);
+            Model::trainingThread(0, pipeline.get(), pipeline ? nullptr : batchReaders[0].get());
         }
+
+        // Checkpoints are taken between chunks: the workers are parked in
+        // the scheduler and, with reader threads, every queued batch is
+        // trained first, so that the untaken chunks, the weights and the
+        // per-thread state agree. Snapshots are taken while training runs.
+        // Both are written by a background writer, one at a time; the
+        // workers only wait for the fork.
+        if (checkpointing || snapshotting) {
+            long nextCheckpointWords = trainedWordCount + checkpointWords;
+            long nextSnapshotWords = trainedWordCount + snapshotWords;
+            auto lastCheckpointTime = std::chrono::system_clock::now();
+            auto lastSnapshotTime = lastCheckpointTime;
+            auto due = [&](long words, long nextWords, float minutes, std::chrono::system_clock::time_point last) {
+                float elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - last).count() / 60000.0f;
+                return (words > 0 && trainedWordCount >= nextWords) || (minutes > 0 && elapsed >= minutes);
+            };
+            while (finishedTrainerNum < threadNum) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (!reapBackgroundWriter(false)) {
+                    continue;
+                }
+                if (due(checkpointWords, nextCheckpointWords, checkpointMinutes, lastCheckpointTime)) {
+                    scheduler->pause();
+                    if (scheduler->waitParked()) {
+                        while (pipeline && !pipeline->idle()) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        }
+                        prepareCheckpoint(checkpointFile);
+                        writeInBackground([this] { return writeCheckpoint(); });
+                    }
+                    scheduler->resume();
+                    nextCheckpointWords = trainedWordCount + checkpointWords;
+                    lastCheckpointTime = std::chrono::system_clock::now();
+                } else if (due(snapshotWords, nextSnapshotWords, snapshotMinutes, lastSnapshotTime)) {
+                    prepareSnapshot(modelDir + "snapshot_" + std::to_string(trainedWordCount.load()));
+                    writeInBackground([this] { return writeSnapshot(); });
+                    nextSnapshotWords = trainedWordCount + snapshotWords;
+                    lastSnapshotTime = std::chrono::system_clock::now();
+                }
+            }
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        reporter.join();
+        reapBackgroundWriter(true);
         printf("\n");
+
+        if (pipeline) {
+            printf("Reader wait: %.2fs  Trainer wait: %.2fs  Queue occupancy: %.2f/%d  \n", pipeline->readerWaitSeconds(), pipeline->trainerWaitSeconds(), pipeline->meanOccupancy(), pipeline->capacity());
+        }
     }
 
     void Model::initializeWeight() {
         embeddingInWeight.setRandomUniform(-0.5 / embeddingLayerSize, 0.5 / embeddingLayerSize);
+
+        sv4d::kernel::setStochasticRounding(stochasticRounding);
+
+        size_t bytes = senseSelectionOutWeight.bytes() + embeddingInWeight.bytes() + embeddingOutWeight.bytes();
+        size_t fp32Bytes = sv4d::Matrix::bytes(senseSelectionOutWeight.row, senseSelectionOutWeight.col, sv4d::kernel::Precision::Fp32)
+                         + sv4d::Matrix::bytes(embeddingInWeight.row + embeddingOutWeight.row, embeddingLayerSize, sv4d::kernel::Precision::Fp32);
+        printf("Weight storage: %s  %.2fMB  (%.2fMB saved)  \n", sv4d::kernel::precisionName(storagePrecision), bytes / 1048576.0, (fp32Bytes - bytes) / 1048576.0);
     }
 
-    void Model::initializeUnigramTable() {
+    void Model::initializeNegativeSampler() {
         const double power = 0.75;
         double trainWordsPow = 0;
 
+        if (negativeSampler == "alias") {
+            auto weights = std::vector<double>(vocab.wordVocabSize);
+            for (int a = 0; a < vocab.wordVocabSize; ++a) {
+                weights[a] = std::pow(vocab.wordFreq[a], power);
+            }
+            aliasSampler.build(weights);
+            printf("Negative sampler: alias  %.2fMB  \n", aliasSampler.bytes() / 1048576.0);
+            return;
+        }
+
         unigramTable.resize(UnigramTableSize);
         
         for (int a = 0; a < vocab.wordVocabSize; ++a) {
@@ -113,6 +297,7 @@ namespace sv4d {
 
         std::mt19937 engine(495);
         std::shuffle(unigramTable.begin(), unigramTable.end(), engine);
+        printf("Negative sampler: table  %.2fMB  \n", UnigramTableSize * sizeof(int) / 1048576.0);
     }
 
     void Model::initializeSubsamplingFactorTable() {
@@ -127,18 +312,10 @@ namespace sv4d {
         }
     }
 
-    void Model::initializeFileSize() {
-        std::ifstream fin(trainingCorpus);
-        if (fin.fail()) {
-            throw std::runtime_error("Cannot open training data file");
-        }
-        fin.seekg(0, fin.end);
-        fileSize = fin.tellg();
-    }
-
     void Model::initializeStopWords() {
         std::string linebuf;
-        std::ifstream fin(trainingCorpus);
+        stopWords.assign(vocab.synsetVocabSize, false);
+        std::ifstream fin(stopWordsFile);
         if (fin.fail()) {
             return;
         }
@@ -149,227 +326,760 @@ namespace sv4d {
                 continue;
             }
 
-            stopWords.insert(vocab.synsetVocab[word]);
+            stopWords[vocab.synsetVocab[word]] = true;
         }
     }
 
-    void Model::trainingThread(const int threadId) {
-        std::string linebuf;
+    // Fills batch with the next sentences of the reader's chunk, taking the
+    // next chunk from the scheduler at the end of it. Returns false once the
+    // scheduler runs out of chunks.
+    bool Model::readBatch(sv4d::BatchReader& reader, sv4d::TrainingBatch& batch) {
+        std::uniform_real_distribution<double> rand(0, 1);
+        auto& corpus = *reader.corpus;
+        auto& sentenceBuffer = reader.sentenceBuffer;
+        auto& sentencesCache = reader.sentencesCache;
+        auto& subSampledCache = reader.subSampledCache;
+        auto& sentenceVectorsCache = reader.sentenceVectorsCache;
+        auto& counts = reader.counts;
+        bool timed = telemetry != "off";
+        long startNs = timed ? sv4d::telemetry::nowNs() : 0;
 
-        // file
-        std::ifstream fin(trainingCorpus);
-        if (fin.fail()) {
-            throw std::runtime_error("Cannot open training data file");
+        while (true) {
+            if (corpus.finished()) {
+                sv4d::CorpusChunk chunk;
+                if (!reader.scheduler->next(reader.workerId, chunk)) {
+                    if (timed) {
+                        counts[sv4d::telemetry::Read] += sv4d::telemetry::nowNs() - startNs;
+                    }
+                    reader.counters.publish(counts);
+                    return false;
+                }
+                corpus.seek(chunk);
+                sentencesCache.clear();
+                subSampledCache.clear();
+                sentenceVectorsCache.clear();
+                continue;
+            }
+
+            long processedWordCount = 0;
+
+            // cache sentence for faster calculation
+            bool bod = false; // begin of document
+            bool eod = false; // end of document
+            while (true) {
+                auto line = corpus.next(sentenceBuffer);
+                if (line == sv4d::CorpusReader::Line::End) {
+                    break;
+                } else if (line == sv4d::CorpusReader::Line::DocumentBegin) {
+                    bod = true;
+                    continue;
+                } else if (line == sv4d::CorpusReader::Line::DocumentEnd) {
+                    eod = true;
+                    break;
+                } else {
+                    processedWordCount += sentenceBuffer.size();
+                    if (sentenceBuffer.size() >= 5) {
+                        sentencesCache.push_back(sentenceBuffer);
+
+                        auto subSampled = std::vector<char>();
+                        subSampled.reserve(sentenceBuffer.size());
+                        for (auto d : sentenceBuffer) {
+                            subSampled.push_back(subsamplingFactorTable[d] < rand(reader.mt));
+                            counts[sv4d::telemetry::SubsampledPositions] += subSampled.back();
+                        }
+                        subSampledCache.push_back(std::move(subSampled));
+
+                        long sentenceVectorNs = timed ? sv4d::telemetry::nowNs() : 0;
+                        sv4d::Vector sentenceVector = sv4d::Vector(embeddingLayerSize);
+                        for (auto d : sentenceBuffer) {
+                            sv4d::VectorView embeddingInVector = embeddingInWeight[d];
+                            sentenceVector += embeddingInVector;
+                        }
+                        sentenceVector /= (int)sentenceBuffer.size();
+                        sentenceVectorsCache.push_back(sentenceVector);
+                        if (timed) {
+                            sentenceVectorNs = sv4d::telemetry::nowNs() - sentenceVectorNs;
+                            counts[sv4d::telemetry::SentenceVector] += sentenceVectorNs;
+                            // read time is the rest
+                            startNs += sentenceVectorNs;
+                        }
+                    }
+                    if (sentencesCache.size() > batchSize) {
+                        break;
+                    }
+                    if (corpus.finished()) {
+                        break;
+                    }
+                }
+            }
+
+            int sentenceCount = sentencesCache.size();
+            if (sentenceCount == 0) {
+                continue;
+            }
+
+            batch.sentences.assign(sentencesCache.begin(), sentencesCache.end());
+            batch.subSampled.assign(subSampledCache.begin(), subSampledCache.end());
+            batch.sentenceVectors.assign(sentenceVectorsCache.begin(), sentenceVectorsCache.end());
+            batch.begin = !bod;
+            batch.end = sentenceCount - (!eod);
+            batch.wordCount = processedWordCount;
+
+            // keep the last two sentences as context of the next batch
+            if (eod) {
+                sentencesCache.clear();
+                subSampledCache.clear();
+                sentenceVectorsCache.clear();
+            } else {
+                for (int i = 0; i < sentenceCount - 2; ++i) {
+                    sentencesCache.pop_front();
+                    subSampledCache.pop_front();
+                    sentenceVectorsCache.pop_front();
+                }
+            }
+
+            counts[sv4d::telemetry::Words] += processedWordCount;
+            if (timed) {
+                counts[sv4d::telemetry::Read] += sv4d::telemetry::nowNs() - startNs;
+            }
+            reader.counters.publish(counts);
+            return true;
         }
+    }
+
+    void Model::readerThread(const int readerId, sv4d::Pipeline* pipeline, sv4d::BatchReader* reader) {
+        while (true) {
+            auto batch = std::unique_ptr<sv4d::TrainingBatch>(new sv4d::TrainingBatch());
+            if (!readBatch(*reader, *batch)) {
+                break;
+            }
+            pipeline->push(readerId, batch.release());
+        }
+        pipeline->close(readerId);
+    }
+
+    void Model::trainingThread(const int threadId, sv4d::Pipeline* pipeline, sv4d::BatchReader* reader) {
+        // batches come from the pipeline, or are read inline from chunks
+        // the reader takes from the scheduler without one
+        auto batch = std::unique_ptr<sv4d::TrainingBatch>();
+        TrainerState& state = *trainerStates[threadId];
 
         // random
-        std::mt19937 mt(495 + threadId);
-        std::uniform_real_distribution<double> rand(0, 1);
+        std::mt19937& mt = state.mt;
         std::uniform_int_distribution<int> rndwindow(0, windowSize - 1);
 
-        // initialize negative sampling position
-        int negativePos = mt() % UnigramTableSize + 1;
+        // counts published once per batch; phases are timed only with
+        // telemetry, each lap() adding the time since the last one
+        sv4d::telemetry::ThreadCounters& counters = *trainerCounters[threadId];
+        sv4d::telemetry::Counts counts;
+        bool timed = telemetry != "off";
+        long lapNs = 0;
+        auto lap = [&](sv4d::telemetry::Counter phase) {
+            if (timed) {
+                long ns = sv4d::telemetry::nowNs();
+                counts[phase] += ns - lapNs;
+                lapNs = ns;
+            }
+        };
+
+        // negative sampling position
+        int& negativePos = state.negativePos;
+        sv4d::FastRandom& negativeRandom = state.negativeRandom;
+        bool aliasNegative = negativeSampler == "alias";
+        auto drawNegative = [&]() {
+            counts[sv4d::telemetry::Negatives] += 1;
+            if (aliasNegative) {
+                return aliasSampler.sample(negativeRandom());
+            }
+            int sample = unigramTable[--negativePos];
+            if (negativePos == 0) {
+                negativePos = UnigramTableSize;
+            }
+            return sample;
+        };
+
+        // rounding of half precision weight updates
+        sv4d::kernel::seedRounding(state.roundingSeed);
 
         // hyper parameter
-        float lr = initialLearningRate;
-        float temp = initialTemperature;
+        float& lr = state.lr;
+        float& temp = state.temp;
 
         // cache
-        int processedWordCount = 0;
-        auto sentencesCache = std::deque<std::vector<int>>();
-        auto sentenceVectorsCache = std::deque<sv4d::Vector>();
-
         auto outputWidxCandidateCache = std::vector<int>();
         outputWidxCandidateCache.reserve(windowSize * 2);
-        auto subSampledCache = std::vector<bool>();
-        subSampledCache.reserve(4096);
-        auto dictPairPos = std::unordered_map<int, int>();
+        // cursor into each synset's dictionary pairs
+        std::vector<int>& dictPairPos = state.dictPairPos;
 
         sv4d::Vector documentVectorCache = sv4d::Vector(embeddingLayerSize);
-        sv4d::Vector contextVectorCache = sv4d::Vector(embeddingLayerSize);
-        sv4d::Vector featureVectorCache = sv4d::Vector(embeddingLayerSize * 3);
 
-        for (int iter = 0; iter < epochs; ++iter) {
-            fin.clear();
-            fin.seekg(fileSize / threadNum * threadId, fin.beg);
-            // seek to head of sentence
-            std::getline(fin, linebuf);
+        // window sums kept across positions and sentences with
+        // incrementalContext
+        sv4d::Vector contextWindowSum = sv4d::Vector(embeddingLayerSize);
+        sv4d::Vector documentWindowSum = sv4d::Vector(embeddingLayerSize);
+
+        // Sense selection of one sentence. Positions with the same word form
+        // a group whatever part of speech each of them drew; their feature
+        // vectors (context, sentence and document vectors) are consecutive
+        // rows of featureBlock. A word's senses are consecutive in
+        // senseLemmas, ordered by part of speech, so the group covers the
+        // senses from the first to the last part of speech its positions
+        // drew, and the group's logits are one block product computed before
+        // any position of the sentence is trained. Each position reads the
+        // columns of its own part of speech.
+        struct SenseGroup {
+            int senseBegin;
+            int senseEnd;
+            int senseNum;
+            int positionNum;
+            int featureRow;
+            int senseRow;
+            int logit;
+            // first and last position in keptPositionIndex order
+            int firstPosition;
+            int lastPosition;
+            // columns [rewardColumn, rewardColumn + rewardColumnNum) of the
+            // group's sense-context dots, starting at rewardDots[rewardDot]
+            int rewardColumn;
+            int rewardColumnNum;
+            int rewardDot;
+        };
+        auto senseGroups = std::vector<SenseGroup>();
+        auto senseGroupIndex = std::unordered_map<int, int>();
+        auto positionGroup = std::vector<int>();
+        auto positionSenseBegin = std::vector<int>();
+        auto positionSenseNum = std::vector<int>();
+        auto positionFeatureRow = std::vector<int>();
+        auto senseLogits = std::vector<float>();
+        sv4d::Matrix featureBlock;
+        // fp32 sense selection rows are read in place, rows stored in half
+        // precision are widened into senseSelectionBlock
+        sv4d::Matrix senseSelectionBlock;
+        int senseSelectionStride = sv4d::Matrix::bytes(1, embeddingLayerSize * 3, sv4d::kernel::Precision::Fp32) / sizeof(float);
+
+        // Rewards with cachedReward. The reward windows count positions that
+        // are not subsampled, so the context rows of those positions are
+        // gathered in order into contextOutBlock and contextInBlock and a
+        // window is a contiguous range of rows. Dots of each group's senses
+        // with the context rows its positions can see are one block product
+        // per sentence; dots of a dictionary sample with every context row
+        // are computed when the sample is first drawn in the sentence and
+        // reused by later positions. Both are taken from the weights as they
+        // were when first computed.
+        auto keptPositionIndex = std::vector<int>();
+        auto rewardDots = std::vector<float>();
+        auto dictRewardRow = std::unordered_map<int, int>();
+        auto dictRewardDots = std::vector<float>();
+        auto rewardSamples = std::vector<int>();
+        auto missedSamples = std::vector<int>();
+        sv4d::Matrix contextOutBlock;
+        sv4d::Matrix contextInBlock;
+        sv4d::Matrix rewardSenseBlock;
+        sv4d::Matrix rewardSampleBlock;
+
+        int maxSenseNum = compiledVocab.maxSenseNum;
+        sv4d::Vector senseSelectionLogitsBuffer = sv4d::Vector(maxSenseNum);
+        sv4d::Vector senseSelectionProbTemperatureBuffer = sv4d::Vector(maxSenseNum);
+        sv4d::Vector senseSelectionProbBuffer = sv4d::Vector(maxSenseNum);
+        sv4d::Vector rewardLogitsBuffer = sv4d::Vector(maxSenseNum);
+        sv4d::Vector rewardProbBuffer = sv4d::Vector(maxSenseNum);
+        if (cachedReward) {
+            rewardSampleBlock = sv4d::Matrix(maxSenseNum * std::max(dictSample, 1), embeddingLayerSize);
+        }
 
-            sentencesCache.clear();
-            sentenceVectorsCache.clear();
+        sv4d::Vector embeddingInBufVector = sv4d::Vector(embeddingLayerSize);
+        sv4d::Vector embeddingOutBufVector = sv4d::Vector(embeddingLayerSize);
 
-            // generate batch and process
-            while (true) {
-                if (fin.tellg() > fileSize / threadNum * (threadId + 1)) {
-                    break;
-                }
+        auto negativeSamples = std::vector<int>(negativeSample);
+        sv4d::Vector negativeScores = sv4d::Vector(negativeSample);
 
-                // clear cache
-                processedWordCount = 0;
+        // Rows of the shared weights. With deterministic every row a thread
+        // touches in a round is trained in a private copy, so the shared
+        // weights do not change until the copies are merged at the end of
+        // the round.
+        RoundCopies* copies = deterministic ? roundCopies[threadId].get() : nullptr;
+        auto inputRow = [&](int sidx) -> sv4d::VectorView {
+            if (copies != nullptr) {
+                return copies->embeddingIn.get(sidx, embeddingInWeight[sidx]);
+            }
+            return embeddingInWeight[sidx];
+        };
+        auto senseSelectionRow = [&](int lidx) -> sv4d::VectorView {
+            if (copies != nullptr) {
+                return copies->senseSelectionOut.get(lidx, senseSelectionOutWeight[lidx]);
+            }
+            return senseSelectionOutWeight[lidx];
+        };
+        auto senseSelectionBias = [&](int lidx) -> float& {
+            if (copies != nullptr) {
+                return copies->senseSelectionBias.get(lidx, sv4d::VectorView(&senseSelectionOutBias[lidx], 1))[0];
+            }
+            return senseSelectionOutBias[lidx];
+        };
+
+        // Hot output rows. The most frequent words have the lowest word
+        // indices and take most output updates from every thread, so with
+        // hotRows each thread reads and trains a private copy of the first
+        // hotRowNum rows instead of the shared ones. Every hotRowSync
+        // trained positions and at the end of every batch the change of
+        // each copy is added to the shared row.
+        int hotRowNum = deterministic ? 0 : std::min(hotRows, vocab.wordVocabSize);
+        sv4d::RowCopies hotOutRows = sv4d::RowCopies(hotRowNum, embeddingLayerSize);
+        int unmergedPositionNum = 0;
+        auto outputRow = [&](int widx) -> sv4d::VectorView {
+            if (copies != nullptr) {
+                return copies->embeddingOut.get(widx, embeddingOutWeight[widx]);
+            }
+            if (widx >= hotRowNum) {
+                return embeddingOutWeight[widx];
+            }
+            return hotOutRows.get(widx, embeddingOutWeight[widx]);
+        };
+        auto mergeHotRows = [&]() {
+            hotOutRows.takeDeltas();
+            hotOutRows.addDeltas([&](int widx) { return embeddingOutWeight[widx]; }, 0, 1);
+            hotOutRows.clear();
+            unmergedPositionNum = 0;
+        };
+
+        // Shared negatives: the rows in blockRows (senses of the input word
+        // and the word itself) are trained against the output word and one
+        // negative set as a block. Scores, input gradients and output
+        // gradients are each one product of small dense blocks, taken before
+        // any row is updated; negatives found in a row's dictionary pairs get
+        // no gradient from that row.
+        auto blockRows = std::vector<int>();
+        auto blockWeights = std::vector<float>();
+        auto blockDictPairs = std::vector<int>();
+        sv4d::Matrix inputBlock;
+        sv4d::Matrix inputGradBlock;
+        sv4d::Matrix outputBlock;
+        sv4d::Matrix outputGradBlock;
+        sv4d::Matrix scoreBlock;
+        if (sharedNegative) {
+            inputBlock = sv4d::Matrix(maxSenseNum + 1, embeddingLayerSize);
+            inputGradBlock = sv4d::Matrix(maxSenseNum + 1, embeddingLayerSize);
+            outputBlock = sv4d::Matrix(negativeSample + 1, embeddingLayerSize);
+            outputGradBlock = sv4d::Matrix(negativeSample + 1, embeddingLayerSize);
+            scoreBlock = sv4d::Matrix(maxSenseNum + 1, negativeSample + 1);
+        }
+        auto trainSharedNegativeBlock = [&](int outputWidx, int negativeNum) {
+            int inputNum = blockRows.size();
+            int outputNum = negativeNum + 1;
+            for (int i = 0; i < inputNum; ++i) {
+                inputBlock[i].assign(inputRow(blockRows[i]));
+                inputGradBlock[i].setZero();
+            }
+            outputBlock[0].assign(outputRow(outputWidx));
+            outputGradBlock[0].setZero();
+            for (int j = 0; j < negativeNum; ++j) {
+                outputBlock[j + 1].assign(outputRow(negativeSamples[j]));
+                outputGradBlock[j + 1].setZero();
+            }
 
-                // cache sentence for faster calculation
-                bool bod = false; // begin of document
-                bool eod = false; // end of document
-                while (std::getline(fin, linebuf)) {
-                    linebuf = sv4d::utils::string::trim(linebuf);
-                    if (linebuf == "<doc>") {
-                        bod = true;
-                        continue;
-                    } else if (linebuf == "") {
-                        continue;
-                    } else if (linebuf == "</doc>") {
-                        eod = true;
-                        break;
+            // x = v_in' * v_out for every pair; column 0 is the output word
+            sv4d::kernel::gemmNT(inputNum, outputNum, embeddingLayerSize, (const float*)inputBlock.data, inputBlock.stride, (const float*)outputBlock.data, outputBlock.stride, (float*)scoreBlock.data, scoreBlock.stride);
+
+            // g = sigmoid(-x) for the output word and -sigmoid(x) for samples,
+            // scaled by the row's learning rate
+            for (int i = 0; i < inputNum; ++i) {
+                float* g = (float*)scoreBlock[i].data;
+                g[0] = sv4d::utils::operation::sigmoid(-g[0]) * blockWeights[i];
+                sv4d::kernel::sigmoid(g + 1, g + 1, negativeNum);
+                const int* dictPair = blockDictPairs[i] == -1 ? nullptr : compiledVocab.dictPairBegin(blockDictPairs[i]);
+                const int* dictPairEnd = blockDictPairs[i] == -1 ? nullptr : dictPair + compiledVocab.dictPairNum(blockDictPairs[i]);
+                for (int j = 0; j < negativeNum; ++j) {
+                    if (std::find(dictPair, dictPairEnd, negativeSamples[j]) != dictPairEnd) {
+                        g[j + 1] = 0.0f;
                     } else {
-                        auto sentence = std::vector<int>();
-                        for (auto word : sv4d::utils::string::split(linebuf, ' ')) {
-                            
-                            if (vocab.synsetVocab.find(word) == vocab.synsetVocab.end()) {
-                                continue;
-                            }
-                            int widx = vocab.synsetVocab[word];
-                            if (vocab.wordFreq[widx] == 0) {
-                                continue;
-                            }
-                            sentence.push_back(widx);
-                        }
-                        processedWordCount += sentence.size();
-                        if (sentence.size() >= 5) {
-                            sentencesCache.push_back(sentence);
-
-                            sv4d::Vector sentenceVector = sv4d::Vector(embeddingLayerSize);
-                            for (auto d : sentence) {
-                                sv4d::Vector& embeddingInVector = embeddingInWeight[d];
-                                sentenceVector += embeddingInVector;
-                            }
-                            sentenceVector /= (int)sentence.size();
-                            sentenceVectorsCache.push_back(sentenceVector);
-                        }
-                        if (sentencesCache.size() > batchSize) {
-                            break;
-                        }
-                        if (fin.tellg() > fileSize / threadNum * (threadId + 1)) {
-                            break;
-                        }
+                        g[j + 1] = -g[j + 1] * blockWeights[i];
                     }
                 }
+            }
 
-                int sentenceCount = sentencesCache.size();
-                if (sentenceCount == 0) {
+            // dl/d(v_in) = G * V_out and dl/d(v_out) = G' * V_in
+            sv4d::kernel::gemmNN(inputNum, outputNum, embeddingLayerSize, (const float*)scoreBlock.data, scoreBlock.stride, (const float*)outputBlock.data, outputBlock.stride, (float*)inputGradBlock.data, inputGradBlock.stride);
+            sv4d::kernel::gemmTN(inputNum, outputNum, embeddingLayerSize, (const float*)scoreBlock.data, scoreBlock.stride, (const float*)inputBlock.data, inputBlock.stride, (float*)outputGradBlock.data, outputGradBlock.stride);
+
+            // dictionary pairs stay per row, as in the level-1 path
+            for (int i = 0; i < inputNum; ++i) {
+                if (blockDictPairs[i] == -1) {
                     continue;
                 }
+                const int* dictPair = compiledVocab.dictPairBegin(blockDictPairs[i]);
+                int dictPairNum = compiledVocab.dictPairNum(blockDictPairs[i]);
+                for (int j = 0; j < dictSample; ++j) {
+                    if (dictPairNum == 0) {
+                        break;
+                    }
+                    int& dpos = dictPairPos[blockRows[i]];
+                    int sample = dictPair[dpos];
+                    if (dpos == dictPairNum - 1) {
+                        dpos = 0;
+                    } else {
+                        dpos += 1;
+                    }
+                    sv4d::VectorView vSample = outputRow(sample);
+                    float dot = inputBlock[i] % vSample;
+                    float g = sv4d::utils::operation::sigmoid(-dot);
+                    float w = g * blockWeights[i] * betaDict;
+                    inputGradBlock[i].fusedMultiplyAdd(vSample, w);
+                    vSample.fusedMultiplyAdd(inputBlock[i], w);
+                }
+            }
 
-                int targetSentenceCount = sentenceCount - (!eod);
-                // process batch
-                for (int r = 0 + (!bod); r < targetSentenceCount; ++r) {
-                    auto& sentence = sentencesCache[r];
-                    int sentenceSize = sentence.size();
+            for (int i = 0; i < inputNum; ++i) {
+                sv4d::VectorView vIn = inputRow(blockRows[i]);
+                vIn += inputGradBlock[i];
+            }
+            embeddingOutBufVector += outputGradBlock[0];
+            for (int j = 0; j < negativeNum; ++j) {
+                sv4d::VectorView vSample = outputRow(negativeSamples[j]);
+                vSample += outputGradBlock[j + 1];
+            }
+        };
 
-                    subSampledCache.clear();
-                    for (auto d : sentence) {
-                        subSampledCache.push_back(subsamplingFactorTable[d] < rand(mt));
+        // with deterministic a thread out of chunks takes part in rounds
+        // with an empty batch until every thread is
+        bool exhausted = false;
+        while (true) {
+            if (pipeline != nullptr) {
+                batch = std::unique_ptr<sv4d::TrainingBatch>(pipeline->pop(threadId));
+                if (!batch) {
+                    break;
+                }
+            } else {
+                if (!batch) {
+                    batch = std::unique_ptr<sv4d::TrainingBatch>(new sv4d::TrainingBatch());
+                }
+                if (exhausted || !readBatch(*reader, *batch)) {
+                    if (!deterministic) {
+                        break;
                     }
+                    exhausted = true;
+                    batch->begin = 0;
+                    batch->end = 0;
+                    batch->wordCount = 0;
+                }
+            }
+
+            int sentenceCount = batch->sentences.size();
+            if (timed) {
+                lapNs = sv4d::telemetry::nowNs();
+            }
 
-                    // document vector
-                    documentVectorCache.setZero();
-                    int minSentPos = r - 1 < 0 ? 0 : r - 1;
-                    int maxSentPos = r + 1 > sentenceCount ? sentenceCount : r + 1;
+            // process batch
+            for (int r = batch->begin; r < batch->end; ++r) {
+                auto& sentence = batch->sentences[r];
+                int sentenceSize = sentence.size();
+
+                auto& subSampledCache = batch->subSampled[r];
+
+                // document vector
+                int minSentPos = r - 1 < 0 ? 0 : r - 1;
+                int maxSentPos = r + 1 > sentenceCount ? sentenceCount : r + 1;
+                if (incrementalContext && r != batch->begin && (r - batch->begin) % contextRecomputeInterval != 0) {
+                    // the window moved by one sentence
+                    documentWindowSum += batch->sentenceVectors[maxSentPos - 1];
+                    if (minSentPos > 0) {
+                        documentWindowSum -= batch->sentenceVectors[minSentPos - 1];
+                    }
+                } else {
+                    documentWindowSum.setZero();
                     for (int i = minSentPos; i < maxSentPos; ++i) {
-                        documentVectorCache += sentenceVectorsCache[i];
+                        documentWindowSum += batch->sentenceVectors[i];
                     }
-                    documentVectorCache /= (maxSentPos - minSentPos);
-
-                    // sentence vector
-                    sv4d::Vector& sentenceVectorCache = sentenceVectorsCache[r];
+                }
+                documentVectorCache.assign(documentWindowSum);
+                documentVectorCache /= (maxSentPos - minSentPos);
+                lap(sv4d::telemetry::SentenceVector);
+
+                // pos selection (random) and grouping of positions
+                senseGroups.clear();
+                senseGroupIndex.clear();
+                positionGroup.assign(sentenceSize, -1);
+                positionSenseBegin.assign(sentenceSize, -1);
+                positionSenseNum.assign(sentenceSize, 0);
+                positionFeatureRow.assign(sentenceSize, -1);
+                keptPositionIndex.resize(sentenceSize);
+                int keptNum = 0;
+                for (int pos = 0; pos < sentenceSize; ++pos) {
+                    keptPositionIndex[pos] = keptNum;
+                    if (!subSampledCache[pos]) {
+                        keptNum += 1;
+                    }
+                }
+                for (int pos = 0; pos < sentenceSize; ++pos) {
+                    int validPosNum = compiledVocab.validPosNum(sentence[pos]);
+                    if (subSampledCache[pos] || validPosNum == 0) {
+                        continue;
+                    }
+                    int targetPos = compiledVocab.validPosAt(sentence[pos], mt() % validPosNum);
+                    int senseBegin = compiledVocab.senseBegin(sentence[pos], targetPos);
+                    int senseEnd = senseBegin + compiledVocab.senseNum(sentence[pos], targetPos);
+                    auto it = senseGroupIndex.find(sentence[pos]);
+                    if (it == senseGroupIndex.end()) {
+                        it = senseGroupIndex.insert(std::make_pair(sentence[pos], (int)senseGroups.size())).first;
+                        senseGroups.push_back({senseBegin, senseEnd, 0, 0, 0, 0, 0, keptPositionIndex[pos], 0, 0, 0, 0});
+                    }
+                    SenseGroup& group = senseGroups[it->second];
+                    group.senseBegin = std::min(group.senseBegin, senseBegin);
+                    group.senseEnd = std::max(group.senseEnd, senseEnd);
+                    group.positionNum += 1;
+                    group.lastPosition = keptPositionIndex[pos];
+                    positionGroup[pos] = it->second;
+                    positionSenseBegin[pos] = senseBegin;
+                    positionSenseNum[pos] = senseEnd - senseBegin;
+                }
 
-                    for (int pos = 0; pos < sentenceSize; ++pos) {
-                        if (subSampledCache[pos]) {
-                            continue;
+                int featureRowNum = 0;
+                int senseRowNum = 0;
+                int logitNum = 0;
+                int maxGroupSenseNum = 0;
+                for (auto& group : senseGroups) {
+                    group.senseNum = group.senseEnd - group.senseBegin;
+                    maxGroupSenseNum = std::max(maxGroupSenseNum, group.senseNum);
+                    int senseNum = group.senseNum;
+                    group.featureRow = featureRowNum;
+                    group.senseRow = senseRowNum;
+                    group.logit = logitNum;
+                    featureRowNum += group.positionNum;
+                    senseRowNum += senseNum;
+                    logitNum += group.positionNum * senseNum;
+                    group.positionNum = 0;
+                }
+                if (featureBlock.row < featureRowNum) {
+                    featureBlock = sv4d::Matrix(std::max(featureRowNum, featureBlock.row * 2), embeddingLayerSize * 3);
+                }
+                if (senseSelectionOutWeight.precision != sv4d::kernel::Precision::Fp32 && senseSelectionBlock.row < senseRowNum) {
+                    senseSelectionBlock = sv4d::Matrix(std::max(senseRowNum, senseSelectionBlock.row * 2), embeddingLayerSize * 3);
+                }
+                senseLogits.resize(logitNum);
+
+                // feature vectors
+                for (int pos = 0; pos < sentenceSize && featureRowNum > 0; ++pos) {
+                    int minPos = pos - windowSize < 0 ? 0 : pos - windowSize;
+                    int maxPos = pos + windowSize >= sentenceSize ? sentenceSize - 1 : pos + windowSize;
+                    if (incrementalContext) {
+                        // slide the sum over [minPos, maxPos] by one position,
+                        // recomputing it every contextRecomputeInterval positions
+                        // to bound drift
+                        if (pos % contextRecomputeInterval == 0) {
+                            contextWindowSum.setZero();
+                            for (int pos2 = minPos; pos2 <= maxPos; ++pos2) {
+                                contextWindowSum += inputRow(sentence[pos2]);
+                            }
+                        } else {
+                            if (pos + windowSize < sentenceSize) {
+                                contextWindowSum += inputRow(sentence[maxPos]);
+                            }
+                            if (pos - windowSize - 1 >= 0) {
+                                contextWindowSum -= inputRow(sentence[pos - windowSize - 1]);
+                            }
                         }
+                    }
 
-                        // output widx
-                        outputWidxCandidateCache.clear();
-                        int reducedWindowSize = windowSize - rndwindow(mt);
-                        for (int pos2 = pos - 1, count = reducedWindowSize; pos2 >= 0 && count != 0; --pos2) {
-                            if (subSampledCache[pos2]) {
+                    if (positionGroup[pos] == -1) {
+                        continue;
+                    }
+                    SenseGroup& group = senseGroups[positionGroup[pos]];
+                    int row = group.featureRow + group.positionNum;
+                    group.positionNum += 1;
+                    positionFeatureRow[pos] = row;
+
+                    sv4d::VectorView contextVector = featureBlock[row].slice(0, embeddingLayerSize);
+                    if (incrementalContext) {
+                        contextVector.assign(contextWindowSum);
+                        contextVector -= inputRow(sentence[pos]);
+                    } else {
+                        contextVector.setZero();
+                        for (int pos2 = minPos; pos2 <= maxPos; ++pos2) {
+                            if (pos == pos2) {
                                 continue;
                             }
-                            outputWidxCandidateCache.push_back(sentence[pos2]);
-                            count -= 1;
+                            sv4d::VectorView embeddingInVector = inputRow(sentence[pos2]);
+                            contextVector += embeddingInVector;
                         }
-                        for (int pos2 = pos + 1, count = reducedWindowSize; pos2 < sentenceSize && count != 0; ++pos2) {
-                            if (subSampledCache[pos2]) {
-                                continue;
+                    }
+                    contextVector /= (maxPos - minPos - 1);
+                    featureBlock[row].slice(embeddingLayerSize, embeddingLayerSize).assign(batch->sentenceVectors[r]);
+                    featureBlock[row].slice(embeddingLayerSize * 2, embeddingLayerSize).assign(documentVectorCache);
+                }
+
+                // sense selection logits without bias, one block product per
+                // group and run of fp32 rows adjacent in memory
+                for (auto& group : senseGroups) {
+                    int senseNum = group.senseNum;
+                    const int* lemmas = compiledVocab.senseLemmas.data() + group.senseBegin;
+                    const float* features = (const float*)featureBlock[group.featureRow].data;
+                    for (int i = 0, runNum = 0; i < senseNum; i += runNum) {
+                        sv4d::VectorView first = senseSelectionRow(lemmas[i]);
+                        if (first.precision != sv4d::kernel::Precision::Fp32) {
+                            for (int j = i; j < senseNum; ++j) {
+                                senseSelectionBlock[group.senseRow + j].assign(senseSelectionRow(lemmas[j]));
+                            }
+                            runNum = senseNum - i;
+                            sv4d::kernel::gemmNT(group.positionNum, runNum, embeddingLayerSize * 3, features, featureBlock.stride, (const float*)senseSelectionBlock[group.senseRow + i].data, senseSelectionBlock.stride, senseLogits.data() + group.logit + i, senseNum);
+                            continue;
+                        }
+                        runNum = 1;
+                        while (i + runNum < senseNum) {
+                            sv4d::VectorView next = senseSelectionRow(lemmas[i + runNum]);
+                            if (next.precision != sv4d::kernel::Precision::Fp32 || next.data != first.data + runNum * senseSelectionStride) {
+                                break;
                             }
-                            outputWidxCandidateCache.push_back(sentence[pos2]);
-                            count -= 1;
+                            runNum += 1;
                         }
-                        if (outputWidxCandidateCache.size() == 0) {
+                        sv4d::kernel::gemmNT(group.positionNum, runNum, embeddingLayerSize * 3, features, featureBlock.stride, first.data, senseSelectionStride, senseLogits.data() + group.logit + i, senseNum);
+                    }
+                }
+
+                lap(sv4d::telemetry::SenseTraining);
+
+                // reward dots of the senses, one block product per group
+                if (cachedReward && !senseGroups.empty()) {
+                    if (contextOutBlock.row < keptNum) {
+                        contextOutBlock = sv4d::Matrix(std::max(keptNum, contextOutBlock.row * 2), embeddingLayerSize);
+                        contextInBlock = sv4d::Matrix(contextOutBlock.row, embeddingLayerSize);
+                    }
+                    if (rewardSenseBlock.row < maxGroupSenseNum) {
+                        rewardSenseBlock = sv4d::Matrix(std::max(maxGroupSenseNum, maxSenseNum), embeddingLayerSize);
+                    }
+                    for (int pos = 0; pos < sentenceSize; ++pos) {
+                        if (subSampledCache[pos]) {
                             continue;
                         }
-                        int outputWidx = outputWidxCandidateCache[mt() % outputWidxCandidateCache.size()];
+                        contextOutBlock[keptPositionIndex[pos]].assign(outputRow(sentence[pos]));
+                        contextInBlock[keptPositionIndex[pos]].assign(inputRow(sentence[pos]));
+                    }
 
-                        // context vector
-                        contextVectorCache.setZero();
-                        int minPos = pos - windowSize < 0 ? 0 : pos - windowSize;
-                        int maxPos = pos + windowSize >= sentenceSize ? sentenceSize - 1 : pos + windowSize;
-                        for (int pos2 = minPos; pos2 <= maxPos; ++pos2) {
-                            if (pos == pos2) {
-                                continue;
-                            }
-                            sv4d::Vector& embeddingInVector = embeddingInWeight[sentence[pos2]];
-                            contextVectorCache += embeddingInVector;
+                    int rewardDotNum = 0;
+                    for (auto& group : senseGroups) {
+                        int senseNum = group.senseNum;
+                        group.rewardColumn = std::max(0, group.firstPosition - wsdWindowSize);
+                        group.rewardColumnNum = std::min(keptNum, group.lastPosition + 1 + wsdWindowSize) - group.rewardColumn;
+                        group.rewardDot = rewardDotNum;
+                        rewardDotNum += senseNum * group.rewardColumnNum;
+                    }
+                    rewardDots.resize(rewardDotNum);
+                    for (auto& group : senseGroups) {
+                        int senseNum = group.senseNum;
+                        for (int i = 0; i < senseNum; ++i) {
+                            rewardSenseBlock[i].assign(inputRow(compiledVocab.senseSynsets[group.senseBegin + i]));
                         }
-                        contextVectorCache /= (maxPos - minPos - 1);
+                        sv4d::kernel::gemmNT(senseNum, group.rewardColumnNum, embeddingLayerSize, (const float*)rewardSenseBlock.data, rewardSenseBlock.stride, (const float*)contextOutBlock[group.rewardColumn].data, contextOutBlock.stride, rewardDots.data() + group.rewardDot, group.rewardColumnNum);
+                    }
+                    dictRewardRow.clear();
+                    dictRewardDots.clear();
+                }
+                lap(sv4d::telemetry::Reward);
 
-                        // input widx
-                        int inputWidx = sentence[pos];
+                for (int pos = 0; pos < sentenceSize; ++pos) {
+                    if (subSampledCache[pos]) {
+                        continue;
+                    }
 
-                        // feature vector
-                        for (int i = 0; i < embeddingLayerSize; ++i) {
-                            featureVectorCache[i] = contextVectorCache[i];
-                            featureVectorCache[i + embeddingLayerSize] = sentenceVectorCache[i];
-                            featureVectorCache[i + embeddingLayerSize * 2] = documentVectorCache[i];
+                    // output widx
+                    outputWidxCandidateCache.clear();
+                    int reducedWindowSize = windowSize - rndwindow(mt);
+                    for (int pos2 = pos - 1, count = reducedWindowSize; pos2 >= 0 && count != 0; --pos2) {
+                        if (subSampledCache[pos2]) {
+                            continue;
                         }
+                        outputWidxCandidateCache.push_back(sentence[pos2]);
+                        count -= 1;
+                    }
+                    for (int pos2 = pos + 1, count = reducedWindowSize; pos2 < sentenceSize && count != 0; ++pos2) {
+                        if (subSampledCache[pos2]) {
+                            continue;
+                        }
+                        outputWidxCandidateCache.push_back(sentence[pos2]);
+                        count -= 1;
+                    }
+                    if (outputWidxCandidateCache.size() == 0) {
+                        continue;
+                    }
+                    int outputWidx = outputWidxCandidateCache[mt() % outputWidxCandidateCache.size()];
 
-                        // training
-                        // % means dot operation
-                        {
-                            sv4d::Vector embeddingInBufVector = sv4d::Vector(embeddingLayerSize);
-                            sv4d::Vector embeddingOutBufVector = sv4d::Vector(embeddingLayerSize);
+                    // input widx
+                    int inputWidx = sentence[pos];
 
-                            sv4d::SynsetData& synsetData = vocab.widx2lidxs[inputWidx];
+                    // training
+                    // % means dot operation
+                    {
+                        embeddingOutBufVector.setZero();
 
-                            sv4d::Vector& vWordOut = embeddingOutWeight[outputWidx];
+                        int wordSidx = compiledVocab.wordSynsets[inputWidx];
 
-                            // sense training
-                            if (synsetData.validPos.size() != 0) {
-                                // pos selection (random)
-                                int targetPos = synsetData.validPos[mt() % synsetData.validPos.size()];
-                                auto& synsetLemmaIndices = synsetData.synsetLemmaIndices[targetPos];
+                        sv4d::VectorView vWordOut = outputRow(outputWidx);
 
-                                // sense selection
-                                int senseNum = synsetLemmaIndices.size();
-                                sv4d::Vector senseSelectionLogits = sv4d::Vector(senseNum);
-                                for (int i = 0; i < senseNum; ++i) {
-                                    int lidx = synsetLemmaIndices[i];
-                                    senseSelectionLogits[i] = (featureVectorCache % senseSelectionOutWeight[lidx]) + senseSelectionOutBias[lidx];
+                        // one negative set for every row trained at this position
+                        int sharedNegativeNum = 0;
+                        if (sharedNegative) {
+                            for (int j = 0; j < negativeSample; ++j) {
+                                int sample = drawNegative();
+                                if (sample == outputWidx) {
+                                    continue;
                                 }
-                                sv4d::Vector senseSelectionProbTemperature = senseSelectionLogits.softmax(temp);
-
-                                sv4d::Vector rewardLogits = sv4d::Vector(senseNum);
+                                negativeSamples[sharedNegativeNum] = sample;
+                                sharedNegativeNum += 1;
+                            }
+                        }
 
-                                // embedding module
+                        // sense training
+                        lap(sv4d::telemetry::WordTraining);
+                        if (positionGroup[pos] != -1) {
+                            SenseGroup& group = senseGroups[positionGroup[pos]];
+                            int senseBegin = positionSenseBegin[pos];
+                            // the position's senses are columns [senseOffset, senseOffset + senseNum) of the group
+                            int senseOffset = senseBegin - group.senseBegin;
+                            const int* synsetLemmaIndices = compiledVocab.senseLemmas.data() + senseBegin;
+                            const int* senseSynsets = compiledVocab.senseSynsets.data() + senseBegin;
+                            sv4d::VectorView featureVector = featureBlock[positionFeatureRow[pos]];
+
+                            // sense selection
+                            int senseNum = positionSenseNum[pos];
+                            counts[sv4d::telemetry::Senses] += senseNum;
+                            const float* logits = senseLogits.data() + group.logit + (positionFeatureRow[pos] - group.featureRow) * group.senseNum + senseOffset;
+                            sv4d::VectorView senseSelectionLogits = senseSelectionLogitsBuffer.slice(0, senseNum);
+                            for (int i = 0; i < senseNum; ++i) {
+                                int lidx = synsetLemmaIndices[i];
+                                senseSelectionLogits[i] = logits[i] + senseSelectionBias(lidx);
+                            }
+                            sv4d::VectorView senseSelectionProbTemperature = senseSelectionProbTemperatureBuffer.slice(0, senseNum);
+                            sv4d::VectorView senseSelectionProb = senseSelectionProbBuffer.slice(0, senseNum);
+                            senseSelectionLogits.softmax(temp, senseSelectionProbTemperature, senseSelectionProb);
+
+                            sv4d::VectorView rewardLogits = rewardLogitsBuffer.slice(0, senseNum);
+                            rewardLogits.setZero();
+
+                            // embedding module
+                            if (sharedNegative) {
+                                // sense rows and the word row in one block
+                                blockRows.clear();
+                                blockWeights.clear();
+                                blockDictPairs.clear();
+                                for (int i = 0; i < senseNum; ++i) {
+                                    int sidx = senseSynsets[i];
+                                    blockRows.push_back(sidx);
+                                    blockWeights.push_back(lr * senseSelectionProbTemperature[i]);
+                                    blockDictPairs.push_back(sidx);
+                                }
+                                blockRows.push_back(wordSidx);
+                                blockWeights.push_back(lr);
+                                blockDictPairs.push_back(-1);
+                                trainSharedNegativeBlock(outputWidx, sharedNegativeNum);
+                            } else {
                                 for (int i = 0; i < senseNum; ++i) {
                                     embeddingInBufVector.setZero();
 
                                     float senseWeight = senseSelectionProbTemperature[i];
 
-                                    int sidx = vocab.lidx2sidx[synsetLemmaIndices[i]];
-                                    sv4d::SynsetDictPair& synsetDictPair = vocab.synsetDictPair[sidx];
-                                    auto& dictPair = synsetDictPair.dictPair;
+                                    int sidx = senseSynsets[i];
+                                    const int* dictPair = compiledVocab.dictPairBegin(sidx);
+                                    int dictPairNum = compiledVocab.dictPairNum(sidx);
 
-                                    sv4d::Vector& vSynsetIn = embeddingInWeight[sidx];
+                                    sv4d::VectorView vSynsetIn = inputRow(sidx);
 
                                     // Positive: example predicts label.
                                     //   forward: x = v_in' * v_out
@@ -393,20 +1103,24 @@ namespace sv4d {
                                     //   backward: dl/dx = g = -sigmoid(x)
                                     //             dl/d(v_in) = g * v_out'
                                     //             dl/d(v_out) = v_in' * g
+                                    // The scores of all samples are taken before any update.
+                                    int negativeNum = 0;
                                     for (int j = 0; j < negativeSample; ++j) {
-                                        int sample = unigramTable[--negativePos];
-                                        if (negativePos == 0) {
-                                            negativePos = UnigramTableSize;
-                                        }
+                                        int sample = drawNegative();
                                         if (sample == outputWidx) {
                                             continue;
                                         }
-                                        if (std::find(dictPair.begin(), dictPair.end(), sample) != dictPair.end()) {
+                                        if (std::find(dictPair, dictPair + dictPairNum, sample) != dictPair + dictPairNum) {
                                             continue;
                                         } 
-                                        sv4d::Vector& vSample = embeddingOutWeight[sample];
-                                        float dot = vSynsetIn % vSample;
-                                        float g = -sv4d::utils::operation::sigmoid(dot);
+                                        negativeSamples[negativeNum] = sample;
+                                        negativeScores[negativeNum] = vSynsetIn % outputRow(sample);
+                                        negativeNum += 1;
+                                    }
+                                    sv4d::kernel::sigmoid(negativeScores.data, negativeScores.data, negativeNum);
+                                    for (int j = 0; j < negativeNum; ++j) {
+                                        sv4d::VectorView vSample = outputRow(negativeSamples[j]);
+                                        float g = -negativeScores[j];
                                         float w = g * lr * senseWeight;
                                         // embeddingInBufVector += vSample * w;
                                         // vSample += vSynsetIn * w;
@@ -421,17 +1135,17 @@ namespace sv4d {
                                     //             dl/d(v_in) = g * v_out'
                                     //             dl/d(v_out) = v_in' * g
                                     for (int j = 0; j < dictSample; ++j) {
-                                        if (dictPair.size() == 0) {
+                                        if (dictPairNum == 0) {
                                             break;
                                         }
                                         int& dpos = dictPairPos[sidx];
                                         int sample = dictPair[dpos];
-                                        if (dpos == dictPair.size() - 1) {
+                                        if (dpos == dictPairNum - 1) {
                                             dpos = 0;
                                         } else {
                                             dpos += 1;
                                         }
-                                        sv4d::Vector& vSample = embeddingOutWeight[sample];
+                                        sv4d::VectorView vSample = outputRow(sample);
                                         float dot = vSynsetIn % vSample;
                                         float g = sv4d::utils::operation::sigmoid(-dot);
                                         float w = g * lr * senseWeight * betaDict;
@@ -443,186 +1157,774 @@ namespace sv4d {
 
                                     vSynsetIn += embeddingInBufVector;
                                 }
+                            }
 
-                                // sense selection (update)
-                                for (int i = 0; i < senseNum; ++i) {
-                                    int sidx = vocab.lidx2sidx[synsetLemmaIndices[i]];
-                                    sv4d::SynsetDictPair& synsetDictPair = vocab.synsetDictPair[sidx];
-                                    auto& dictPair = synsetDictPair.dictPair;
-
-                                    // reward by synset embedding
-                                    {
-                                        sv4d::Vector& vSynsetIn = embeddingInWeight[sidx];
-
-                                        float maxDot = std::numeric_limits<float>::lowest();
-                                        for (int pos2 = pos - 1, count = wsdWindowSize; pos2 >= 0 && count != 0; --pos2) {
-                                            if (subSampledCache[pos2]) {
-                                                continue;
-                                            }
-                                            maxDot = std::max(vSynsetIn % embeddingOutWeight[sentence[pos2]], maxDot);
-                                            count -= 1;
+                            // sense selection (update)
+                            lap(sv4d::telemetry::SenseTraining);
+                            if (cachedReward) {
+                                // reward windows as rows of the context blocks
+                                int keptPosition = keptPositionIndex[pos];
+                                int windowBegin = std::max(0, keptPosition - wsdWindowSize);
+                                int windowEnd = std::min(keptNum, keptPosition + 1 + wsdWindowSize);
+                                auto windowMax = [&](const float* dots) {
+                                    float maxDot = std::numeric_limits<float>::lowest();
+                                    for (int c = windowBegin; c < windowEnd; ++c) {
+                                        if (c != keptPosition) {
+                                            maxDot = std::max(dots[c], maxDot);
                                         }
-                                        for (int pos2 = pos + 1, count = wsdWindowSize; pos2 < sentenceSize && count != 0; ++pos2) {
-                                            if (subSampledCache[pos2]) {
-                                                continue;
-                                            }
-                                            maxDot = std::max(vSynsetIn % embeddingOutWeight[sentence[pos2]], maxDot);
-                                            count -= 1;
-                                        }
-
-                                        rewardLogits[i] += maxDot;
                                     }
+                                    return maxDot;
+                                };
+
+                                // reward by synset embedding
+                                for (int i = 0; i < senseNum; ++i) {
+                                    rewardLogits[i] += windowMax(rewardDots.data() + group.rewardDot + (senseOffset + i) * group.rewardColumnNum - group.rewardColumn);
+                                }
 
-                                    // reward by dict pair
+                                // reward by dict pair; samples not yet seen in
+                                // this sentence get their dots as one block
+                                rewardSamples.assign(senseNum * dictSample, -1);
+                                missedSamples.clear();
+                                for (int i = 0; i < senseNum; ++i) {
+                                    int sidx = senseSynsets[i];
+                                    const int* dictPair = compiledVocab.dictPairBegin(sidx);
+                                    int dictPairNum = compiledVocab.dictPairNum(sidx);
                                     for (int j = 0; j < dictSample; ++j) {
-                                        if (dictPair.size() == 0) {
+                                        if (dictPairNum == 0) {
                                             break;
                                         }
                                         int& dpos = dictPairPos[sidx];
                                         int sample = dictPair[dpos];
-                                        if (dpos == dictPair.size() - 1) {
+                                        if (dpos == dictPairNum - 1) {
                                             dpos = 0;
                                         } else {
                                             dpos += 1;
                                         }
-                                        sv4d::Vector& vSample = embeddingOutWeight[sample];
-
-                                        float maxDot = std::numeric_limits<float>::lowest();
-                                        for (int pos2 = pos - 1, count = wsdWindowSize; pos2 >= 0 && count != 0; --pos2) {
-                                            if (subSampledCache[pos2]) {
-                                                continue;
-                                            }
-                                            maxDot = std::max(embeddingInWeight[sentence[pos2]] % vSample, maxDot);
-                                            count -= 1;
+                                        rewardSamples[i * dictSample + j] = sample;
+                                        if (dictRewardRow.find(sample) == dictRewardRow.end()) {
+                                            dictRewardRow[sample] = dictRewardDots.size() / keptNum + missedSamples.size();
+                                            rewardSampleBlock[missedSamples.size()].assign(outputRow(sample));
+                                            missedSamples.push_back(sample);
                                         }
-                                        for (int pos2 = pos + 1, count = wsdWindowSize; pos2 < sentenceSize && count != 0; ++pos2) {
-                                            if (subSampledCache[pos2]) {
-                                                continue;
-                                            }
-                                            maxDot = std::max((embeddingInWeight[sentence[pos2]] % vSample), maxDot);
-                                            count -= 1;
-                                        }
-
-                                        rewardLogits[i] += maxDot * betaReward;
                                     }
                                 }
-
-                                if (stopWords.find(outputWidx) == stopWords.end()) {
-                                    
-                                    sv4d::Vector rewardProb = rewardLogits.softmax(1.0);
-                                    sv4d::Vector senseSelectionProb = senseSelectionLogits.softmax(1.0);
-
-                                    // Update sense selection weight.
-                                    //   forward: x = v_feature' * v_sense_selection + v_sense_bias
-                                    //            l = Σz * log(softmax(x))
-                                    //   backward: dl/dx = g = z - x
-                                    //             dl/d(v_sense_selection) = v_feature' * g
-                                    //             dl/d(v_sense_bias) = g
-                                    for (int i = 0; i < senseNum; ++i) {
-                                        int lidx = synsetLemmaIndices[i];
-                                        float g = rewardProb[i] - senseSelectionProb[i];
-                                        sv4d::Vector& vSenseSelection = senseSelectionOutWeight[lidx];
-                                        float& bSenseSelection = senseSelectionOutBias[lidx];
-                                        float w = g * lr;
-                                        // vSenseSelection += featureVectorCache * w;
-                                        // bSenseSelection += w;
-                                        vSenseSelection.fusedMultiplyAdd(featureVectorCache, w);
-                                        bSenseSelection += w;
+                                if (!missedSamples.empty()) {
+                                    int dotNum = dictRewardDots.size();
+                                    dictRewardDots.resize(dotNum + missedSamples.size() * keptNum);
+                                    sv4d::kernel::gemmNT(missedSamples.size(), keptNum, embeddingLayerSize, (const float*)rewardSampleBlock.data, rewardSampleBlock.stride, (const float*)contextInBlock.data, contextInBlock.stride, dictRewardDots.data() + dotNum, keptNum);
+                                }
+                                for (int i = 0; i < senseNum; ++i) {
+                                    for (int j = 0; j < dictSample; ++j) {
+                                        int sample = rewardSamples[i * dictSample + j];
+                                        if (sample == -1) {
+                                            break;
+                                        }
+                                        rewardLogits[i] += windowMax(dictRewardDots.data() + (long)dictRewardRow[sample] * keptNum) * betaReward;
                                     }
                                 }
                             }
+                            for (int i = 0; i < senseNum && !cachedReward; ++i) {
+                                int sidx = senseSynsets[i];
+                                const int* dictPair = compiledVocab.dictPairBegin(sidx);
+                                int dictPairNum = compiledVocab.dictPairNum(sidx);
 
-                            // word training
-                            {
-                                embeddingInBufVector.setZero();
+                                // reward by synset embedding
+                                {
+                                    sv4d::VectorView vSynsetIn = inputRow(sidx);
 
-                                int wsidx = vocab.lidx2sidx[synsetData.wordLemmaIndex];
+                                    float maxDot = std::numeric_limits<float>::lowest();
+                                    for (int pos2 = pos - 1, count = wsdWindowSize; pos2 >= 0 && count != 0; --pos2) {
+                                        if (subSampledCache[pos2]) {
+                                            continue;
+                                        }
+                                        maxDot = std::max(vSynsetIn % outputRow(sentence[pos2]), maxDot);
+                                        count -= 1;
+                                    }
+                                    for (int pos2 = pos + 1, count = wsdWindowSize; pos2 < sentenceSize && count != 0; ++pos2) {
+                                        if (subSampledCache[pos2]) {
+                                            continue;
+                                        }
+                                        maxDot = std::max(vSynsetIn % outputRow(sentence[pos2]), maxDot);
+                                        count -= 1;
+                                    }
 
-                                sv4d::Vector& vWordIn = embeddingInWeight[wsidx];
-                                
-                                // Positive: example predicts label.
-                                //   forward: x = v_in' * v_out
-                                //            l = log(sigmoid(x))
-                                //   backward: dl/dx = g = sigmoid(-x)
-                                //             dl/d(v_in) = g * v_out'
-                                //             dl/d(v_out) = v_in' * g
-                                {
-                                    float dot = vWordIn % vWordOut;
-                                    float g = sv4d::utils::operation::sigmoid(-dot);
-                                    float w = g * lr;
-                                    // embeddingInBufVector += vWordOut * w;
-                                    // embeddingOutBufVector += vWordIn * w;
-                                    embeddingInBufVector.fusedMultiplyAdd(vWordOut, w);
-                                    embeddingOutBufVector.fusedMultiplyAdd(vWordIn, w);
+                                    rewardLogits[i] += maxDot;
                                 }
 
-                                // Negative samples:
-                                //   forward: x = v_in' * v_sample
-                                //            l = log(sigmoid(-x))
-                                //   backward: dl/dx = g = -sigmoid(x)
-                                //             dl/d(v_in) = g * v_out'
-                                //             dl/d(v_out) = v_in' * g
-                                for (int j = 0; j < negativeSample; ++j) {
-                                    int sample = unigramTable[--negativePos];
-                                    if (negativePos == 0) {
-                                        negativePos = UnigramTableSize;
+                                // reward by dict pair
+                                for (int j = 0; j < dictSample; ++j) {
+                                    if (dictPairNum == 0) {
+                                        break;
+                                    }
+                                    int& dpos = dictPairPos[sidx];
+                                    int sample = dictPair[dpos];
+                                    if (dpos == dictPairNum - 1) {
+                                        dpos = 0;
+                                    } else {
+                                        dpos += 1;
                                     }
-                                    if (sample == outputWidx) {
-                                        continue;
+                                    sv4d::VectorView vSample = outputRow(sample);
+
+                                    float maxDot = std::numeric_limits<float>::lowest();
+                                    for (int pos2 = pos - 1, count = wsdWindowSize; pos2 >= 0 && count != 0; --pos2) {
+                                        if (subSampledCache[pos2]) {
+                                            continue;
+                                        }
+                                        maxDot = std::max(inputRow(sentence[pos2]) % vSample, maxDot);
+                                        count -= 1;
+                                    }
+                                    for (int pos2 = pos + 1, count = wsdWindowSize; pos2 < sentenceSize && count != 0; ++pos2) {
+                                        if (subSampledCache[pos2]) {
+                                            continue;
+                                        }
+                                        maxDot = std::max((inputRow(sentence[pos2]) % vSample), maxDot);
+                                        count -= 1;
                                     }
-                                    sv4d::Vector& vSample = embeddingOutWeight[sample];
-                                    float dot = vWordIn % vSample;
-                                    float g = -sv4d::utils::operation::sigmoid(dot);
+
+                                    rewardLogits[i] += maxDot * betaReward;
+                                }
+                            }
+
+                            lap(sv4d::telemetry::Reward);
+
+                            if (!stopWords[outputWidx]) {
+                                
+                                sv4d::VectorView rewardProb = rewardProbBuffer.slice(0, senseNum);
+                                rewardLogits.softmax(1.0, rewardProb);
+
+                                // Update sense selection weight.
+                                //   forward: x = v_feature' * v_sense_selection + v_sense_bias
+                                //            l = Σz * log(softmax(x))
+                                //   backward: dl/dx = g = z - x
+                                //             dl/d(v_sense_selection) = v_feature' * g
+                                //             dl/d(v_sense_bias) = g
+                                for (int i = 0; i < senseNum; ++i) {
+                                    int lidx = synsetLemmaIndices[i];
+                                    float g = rewardProb[i] - senseSelectionProb[i];
+                                    sv4d::VectorView vSenseSelection = senseSelectionRow(lidx);
+                                    float& bSenseSelection = senseSelectionBias(lidx);
                                     float w = g * lr;
-                                    // embeddingInBufVector += vSample * w;
-                                    // vSample += vWordIn * w;
-                                    embeddingInBufVector.fusedMultiplyAdd(vSample, w);
-                                    vSample.fusedMultiplyAdd(vWordIn, w);
+                                    // vSenseSelection += featureVector * w;
+                                    // bSenseSelection += w;
+                                    vSenseSelection.fusedMultiplyAdd(featureVector, w);
+                                    bSenseSelection += w;
                                 }
+                            }
+                        }
+
+                        // word training
+                        lap(sv4d::telemetry::SenseTraining);
+                        if (sharedNegative) {
+                            // already trained with the senses when there are any
+                            if (compiledVocab.validPosNum(inputWidx) == 0) {
+                                blockRows.assign(1, wordSidx);
+                                blockWeights.assign(1, lr);
+                                blockDictPairs.assign(1, -1);
+                                trainSharedNegativeBlock(outputWidx, sharedNegativeNum);
+                            }
+                        } else {
+                            embeddingInBufVector.setZero();
 
-                                vWordIn += embeddingInBufVector;
+                            int wsidx = wordSidx;
+
+                            sv4d::VectorView vWordIn = inputRow(wsidx);
+                            
+                            // Positive: example predicts label.
+                            //   forward: x = v_in' * v_out
+                            //            l = log(sigmoid(x))
+                            //   backward: dl/dx = g = sigmoid(-x)
+                            //             dl/d(v_in) = g * v_out'
+                            //             dl/d(v_out) = v_in' * g
+                            {
+                                float dot = vWordIn % vWordOut;
+                                float g = sv4d::utils::operation::sigmoid(-dot);
+                                float w = g * lr;
+                                // embeddingInBufVector += vWordOut * w;
+                                // embeddingOutBufVector += vWordIn * w;
+                                embeddingInBufVector.fusedMultiplyAdd(vWordOut, w);
+                                embeddingOutBufVector.fusedMultiplyAdd(vWordIn, w);
+                            }
+
+                            // Negative samples:
+                            //   forward: x = v_in' * v_sample
+                            //            l = log(sigmoid(-x))
+                            //   backward: dl/dx = g = -sigmoid(x)
+                            //             dl/d(v_in) = g * v_out'
+                            //             dl/d(v_out) = v_in' * g
+                            // The scores of all samples are taken before any update.
+                            int negativeNum = 0;
+                            for (int j = 0; j < negativeSample; ++j) {
+                                int sample = drawNegative();
+                                if (sample == outputWidx) {
+                                    continue;
+                                }
+                                negativeSamples[negativeNum] = sample;
+                                negativeScores[negativeNum] = vWordIn % outputRow(sample);
+                                negativeNum += 1;
+                            }
+                            sv4d::kernel::sigmoid(negativeScores.data, negativeScores.data, negativeNum);
+                            for (int j = 0; j < negativeNum; ++j) {
+                                sv4d::VectorView vSample = outputRow(negativeSamples[j]);
+                                float g = -negativeScores[j];
+                                float w = g * lr;
+                                // embeddingInBufVector += vSample * w;
+                                // vSample += vWordIn * w;
+                                embeddingInBufVector.fusedMultiplyAdd(vSample, w);
+                                vSample.fusedMultiplyAdd(vWordIn, w);
                             }
 
-                            vWordOut += embeddingOutBufVector;
+                            vWordIn += embeddingInBufVector;
                         }
+
+                        vWordOut += embeddingOutBufVector;
+                    }
+                    lap(sv4d::telemetry::WordTraining);
+                    counts[sv4d::telemetry::TrainedPositions] += 1;
+
+                    unmergedPositionNum += 1;
+                    if (hotRowNum > 0 && unmergedPositionNum >= hotRowSync) {
+                        mergeHotRows();
                     }
                 }
+            }
 
-                if (eod) {
-                    sentencesCache.clear();
-                    sentenceVectorsCache.clear();
-                } else {
-                    for (int i = 0; i < sentenceCount - 2; ++i) {
-                        sentencesCache.pop_front();
-                        sentenceVectorsCache.pop_front();
+            // a trained batch is in the shared weights, so checkpoints and
+            // snapshots taken between batches see every update
+            if (hotRowNum > 0) {
+                mergeHotRows();
+            }
+
+            long wordCount = 0;
+            if (deterministic) {
+                // End of a round: the changes of every thread's copies are
+                // added to the shared weights, each thread adding those of
+                // its share of the rows from every thread in thread order.
+                // Word counts sum to the same total in any order.
+                copies->senseSelectionOut.takeDeltas();
+                copies->senseSelectionBias.takeDeltas();
+                copies->embeddingIn.takeDeltas();
+                copies->embeddingOut.takeDeltas();
+                trainedWordCount += batch->wordCount;
+                if (!roundBarrier->wait(!exhausted)) {
+                    break;
+                }
+                // read before any thread can add the next round's count
+                wordCount = trainedWordCount;
+                for (auto& threadCopies : roundCopies) {
+                    threadCopies->senseSelectionOut.addDeltas([&](int lidx) { return senseSelectionOutWeight[lidx]; }, threadId, threadNum);
+                    threadCopies->senseSelectionBias.addDeltas([&](int lidx) { return sv4d::VectorView(&senseSelectionOutBias[lidx], 1); }, threadId, threadNum);
+                    threadCopies->embeddingIn.addDeltas([&](int sidx) { return embeddingInWeight[sidx]; }, threadId, threadNum);
+                    threadCopies->embeddingOut.addDeltas([&](int widx) { return embeddingOutWeight[widx]; }, threadId, threadNum);
+                }
+                roundBarrier->wait(false);
+                copies->senseSelectionOut.clear();
+                copies->senseSelectionBias.clear();
+                copies->embeddingIn.clear();
+                copies->embeddingOut.clear();
+            } else {
+                wordCount = trainedWordCount.fetch_add(batch->wordCount) + batch->wordCount;
+            }
+
+            // change hyper parameter
+            float progress = wordCount / (float)(epochs * vocab.totalWordsNum + 1);
+            lr = (initialLearningRate - minLearningRate) * (1.0f - progress) + minLearningRate;
+            temp = (initialTemperature - minTemperature) * (1.0f - progress) + minTemperature;
+
+            counts[sv4d::telemetry::Words] += batch->wordCount;
+            counters.publish(counts);
+
+            state.roundingSeed = sv4d::kernel::roundingSeed();
+            if (pipeline != nullptr) {
+                pipeline->done();
+            }
+        }
+        finishedTrainerNum += 1;
+    }
+
+    // Prints the progress line about once a second and, with telemetry,
+    // exports the counters of every thread every telemetrySeconds, until
+    // every trainer is done. Both are written once more at the end.
+    void Model::reporterThread(sv4d::Pipeline* pipeline) {
+        std::string filepath = modelDir + (telemetry == "json" ? "telemetry.jsonl" : "telemetry.prom");
+        if (telemetry == "json" && startWordCount == 0) {
+            std::ofstream(filepath, std::ios::trunc);
+        }
+        auto lastProgressTime = std::chrono::steady_clock::now();
+        auto lastTelemetryTime = lastProgressTime;
+        while (true) {
+            bool finished = finishedTrainerNum == threadNum;
+            auto now = std::chrono::steady_clock::now();
+            if (finished || now - lastProgressTime >= std::chrono::seconds(1)) {
+                printProgress(pipeline);
+                lastProgressTime = now;
+            }
+            if (telemetry != "off" && (finished || std::chrono::duration_cast<std::chrono::milliseconds>(now - lastTelemetryTime).count() >= telemetrySeconds * 1000.0f)) {
+                exportTelemetry(filepath);
+                lastTelemetryTime = now;
+            }
+            if (finished) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+
+    void Model::printProgress(sv4d::Pipeline* pipeline) {
+        long wordCount = trainedWordCount;
+        float progress = wordCount / (float)(epochs * vocab.totalWordsNum + 1);
+        float lr = (initialLearningRate - minLearningRate) * (1.0f - progress) + minLearningRate;
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - startTime).count();
+        float speed = (wordCount - startWordCount) / (float)((elapsed + 1) * threadNum);
+        float eta = (epochs * vocab.totalWordsNum - wordCount) / (float)(wordCount - startWordCount + 1) * elapsed / 60000.0f;
+        printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  Remaining: %.2fm  ", 13, lr, progress * 100.0f, speed, eta);
+        if (pipeline != nullptr) {
+            printf("Queue: %d/%d  ", pipeline->occupancy(), pipeline->capacity());
+        }
+        fflush(stdout);
+    }
+
+    // Appends a JSON line, or replaces the Prometheus file through a rename
+    // so that a scrape never sees it half written.
+    void Model::exportTelemetry(const std::string& filepath) {
+        sv4d::telemetry::Report report;
+        report.elapsedSeconds = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - startTime).count() / 1000.0;
+        report.trainedWords = trainedWordCount;
+        report.progress = report.trainedWords / (float)(epochs * vocab.totalWordsNum + 1);
+        report.learningRate = (initialLearningRate - minLearningRate) * (1.0f - report.progress) + minLearningRate;
+        for (size_t i = 0; i < trainerCounters.size(); ++i) {
+            report.threads.push_back({"trainer", (int)i, trainerCounters[i]->read()});
+        }
+        for (size_t i = 0; i < batchReaders.size(); ++i) {
+            report.threads.push_back({"reader", (int)i, batchReaders[i]->counters.read()});
+        }
+
+        if (telemetry == "json") {
+            std::ofstream fout(filepath, std::ios::app);
+            fout << sv4d::telemetry::formatJson(report) << "\n";
+            return;
+        }
+        std::string tmppath = filepath + ".tmp";
+        {
+            std::ofstream fout(tmppath, std::ios::trunc);
+            fout << sv4d::telemetry::formatPrometheus(report);
+        }
+        if (std::rename(tmppath.c_str(), filepath.c_str()) != 0) {
+            fprintf(stderr, "Cannot write %s  \n", filepath.c_str());
+        }
+    }
+
+    // Runs write in a forked child, which sees the model as it was at the
+    // fork while the trainers go on; the pages they touch meanwhile are
+    // copied on write. The child runs at the lowest CPU and I/O priority.
+    // Other threads may have held the allocator or stdio locks at the fork,
+    // so write only uses what a prepare function laid out in
+    // backgroundWrite and returns an error as a static message. Without
+    // fork the write is done in the foreground.
+    void Model::writeInBackground(const std::function<const char*()>& write) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            const char* error = write();
+            if (error != nullptr) {
+                throw std::runtime_error(error);
+            }
+            printf("%s", backgroundWrite.message.c_str());
+            return;
+        }
+        if (pid == 0) {
+            setpriority(PRIO_PROCESS, 0, 19);
+#ifdef SYS_ioprio_set
+            // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE
+            syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+            const char* error = write();
+            if (error != nullptr) {
+                ssize_t written = ::write(STDERR_FILENO, error, std::strlen(error));
+                written = ::write(STDERR_FILENO, "\n", 1);
+                (void)written;
+                _exit(EXIT_FAILURE);
+            }
+            _exit(EXIT_SUCCESS);
+        }
+        backgroundWriter = pid;
+        backgroundWriterStart = std::chrono::steady_clock::now();
+        backgroundWriterWarnings = 0;
+    }
+
+    // True once no background write is running; with wait, polls until it
+    // is. A write still running is reported every
+    // BackgroundWriteWarningSeconds with the pid of the writer, since
+    // training cannot finish before it.
+    bool Model::reapBackgroundWriter(bool wait) {
+        if (backgroundWriter <= 0) {
+            return true;
+        }
+        int status = 0;
+        pid_t pid = 0;
+        while ((pid = waitpid(backgroundWriter, &status, WNOHANG)) == 0 || (pid < 0 && errno == EINTR)) {
+            long seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - backgroundWriterStart).count();
+            if (seconds >= (backgroundWriterWarnings + 1) * (long)BackgroundWriteWarningSeconds) {
+                backgroundWriterWarnings += 1;
+                printf("\nBackground write (pid %d) still running after %lds  \n", backgroundWriter, seconds);
+            }
+            if (!wait) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            printf("\nBackground write failed  \n");
+        } else {
+            printf("%s", backgroundWrite.message.c_str());
+        }
+        backgroundWriter = 0;
+        return true;
+    }
+
+    // The output files of training and the vocab in a directory of their
+    // own, which can be passed as -model_dir to evaluate the model so far.
+    void Model::saveSnapshot(const std::string& dirpath) {
+        prepareSnapshot(dirpath);
+        const char* error = writeSnapshot();
+        if (error != nullptr) {
+            throw std::runtime_error(error);
+        }
+        printf("%s", backgroundWrite.message.c_str());
+    }
+
+    void Model::prepareSnapshot(const std::string& dirpath) {
+        BackgroundWrite& out = backgroundWrite;
+        out.path = dirpath;
+        out.tmpPath = dirpath + ".tmp";
+        // the vocab does not change during training
+        out.vocabPath = modelDir + "vocab.txt";
+        out.files.clear();
+        for (const char* file : {"/vocab.txt", "/embedding_in_weight", "/embedding_out_weight", "/sense_selection_out_weight", "/sense_selection_out_bias"}) {
+            out.files.push_back(out.tmpPath + file);
+        }
+        out.biasText.clear();
+        if (!binary) {
+            std::ostringstream text;
+            text << vocab.lemmaVocabSize << " " << 1 << "\n";
+            for (int lidx = 0; lidx < vocab.lemmaVocabSize; ++lidx) {
+                text << vocab.lidx2Lemma[lidx] << " " << senseSelectionOutBias[lidx] << "\n";
+            }
+            out.biasText = text.str();
+        }
+        out.message = "\nSnapshot: " + dirpath + "  \n";
+    }
+
+    const char* Model::writeSnapshot() {
+        BackgroundWrite& out = backgroundWrite;
+        if (mkdir(out.tmpPath.c_str(), 0755) != 0 && errno != EEXIST) {
+            return "Cannot create snapshot directory";
+        }
+        sv4d::utils::io::RawFile fout(out.buffer.data(), out.buffer.size());
+        if (!fout.open(out.files[0].c_str())) {
+            return "Cannot open vocab data file";
+        }
+        fout.append(out.vocabPath.c_str());
+        if (!fout.close()) {
+            return "Cannot copy vocab data file";
+        }
+        const char* error = writeRows(out.files[1], embeddingInWeight, vocab.sidx2Synset);
+        if (error == nullptr) {
+            error = writeRows(out.files[2], embeddingOutWeight, vocab.sidx2Synset);
+        }
+        if (error == nullptr) {
+            error = writeRows(out.files[3], senseSelectionOutWeight, vocab.lidx2Lemma);
+        }
+        if (error != nullptr) {
+            return error;
+        }
+        if (!fout.open(out.files[4].c_str())) {
+            return "Cannot open weight file";
+        }
+        if (binary) {
+            fout.write((long)vocab.lemmaVocabSize);
+            fout.write(" 1\n", 3);
+            for (int lidx = 0; lidx < vocab.lemmaVocabSize; ++lidx) {
+                const std::string& lemma = vocab.lidx2Lemma[lidx];
+                fout.write(lemma.data(), lemma.size());
+                fout.write(' ');
+                fout.write(&senseSelectionOutBias[lidx], sizeof(float));
+                fout.write('\n');
+            }
+        } else {
+            fout.write(out.biasText.data(), out.biasText.size());
+        }
+        if (!fout.close()) {
+            return "Cannot write weight file";
+        }
+        if (std::rename(out.tmpPath.c_str(), out.path.c_str()) != 0) {
+            return "Cannot rename snapshot directory";
+        }
+        return nullptr;
+    }
+
+    // A weight file as saveEmbeddingInWeight and the others write it, one
+    // "<name> <values>" line per row of matrix, without allocating.
+    const char* Model::writeRows(const std::string& filepath, const sv4d::Matrix& matrix, const std::vector<std::string>& names) {
+        sv4d::utils::io::RawFile fout(backgroundWrite.buffer.data(), backgroundWrite.buffer.size());
+        if (!fout.open(filepath.c_str())) {
+            return "Cannot open weight file";
+        }
+        fout.write((long)matrix.row);
+        fout.write(' ');
+        fout.write((long)matrix.col);
+        fout.write('\n');
+        sv4d::VectorView row = backgroundWrite.row.slice(0, matrix.col);
+        for (int i = 0; i < matrix.row; ++i) {
+            fout.write(names[i].data(), names[i].size());
+            fout.write(' ');
+            row.assign(matrix[i]);
+            if (binary) {
+                fout.write(row.data, matrix.col * sizeof(float));
+            } else {
+                // the text format keeps the integer part, see floatvec_to_strvec
+                for (int j = 0; j < matrix.col; ++j) {
+                    if (j > 0) {
+                        fout.write(' ');
                     }
+                    fout.write((long)(int)row[j]);
                 }
+            }
+            fout.write('\n');
+        }
+        if (!fout.close()) {
+            return "Cannot write weight file";
+        }
+        return nullptr;
+    }
+
+    // Everything needed to continue training exactly: the four parameter
+    // tensors in their storage precision, the trained word count, the
+    // compiled vocab, the chunks and the scheduler position, and the random
+    // and schedule state of every thread. Written to a temporary file that
+    // replaces the previous checkpoint only when complete.
+    void Model::saveCheckpoint(const std::string& filepath) {
+        prepareCheckpoint(filepath);
+        const char* error = writeCheckpoint();
+        if (error != nullptr) {
+            throw std::runtime_error(error);
+        }
+        printf("%s", backgroundWrite.message.c_str());
+    }
+
+    // Serializes every field but the weights, which writeCheckpoint copies
+    // as they are.
+    void Model::prepareCheckpoint(const std::string& filepath) {
+        BackgroundWrite& out = backgroundWrite;
+        out.path = filepath;
+        out.tmpPath = filepath + ".tmp";
+
+        std::ostringstream head;
+        head.write(CheckpointMagic, sizeof(CheckpointMagic));
+        sv4d::utils::io::write(head, vocab.lemmaVocabSize);
+        sv4d::utils::io::write(head, vocab.synsetVocabSize);
+        sv4d::utils::io::write(head, vocab.wordVocabSize);
+        sv4d::utils::io::write(head, embeddingLayerSize);
+        sv4d::utils::io::write(head, (int)storagePrecision);
+        out.head = head.str();
+
+        std::ostringstream tail;
+        long wordCount = trainedWordCount.load();
+        sv4d::utils::io::write(tail, wordCount);
+
+        for (const std::vector<int>* array : {&compiledVocab.senseOffsets, &compiledVocab.senseLemmas, &compiledVocab.senseSynsets, &compiledVocab.validPosOffsets, &compiledVocab.validPos, &compiledVocab.wordSynsets, &compiledVocab.dictPairOffsets, &compiledVocab.dictPairs}) {
+            sv4d::utils::io::writeVector(tail, *array);
+        }
+        sv4d::utils::io::write(tail, compiledVocab.maxSenseNum);
 
-                trainedWordCount += processedWordCount;
+        sv4d::utils::io::writeVector(tail, scheduler->getChunks());
+        scheduler->save(tail);
 
-                // change hyper parameter
-                float progress = trainedWordCount / (float)(epochs * vocab.totalWordsNum + 1);
-                lr = (initialLearningRate - minLearningRate) * (1.0f - progress) + minLearningRate;
-                temp = (initialTemperature - minTemperature) * (1.0f - progress) + minTemperature;
+        sv4d::utils::io::write(tail, (int)batchReaders.size());
+        for (auto& reader : batchReaders) {
+            std::ostringstream random;
+            random << reader->mt;
+            sv4d::utils::io::writeString(tail, random.str());
+        }
+        sv4d::utils::io::write(tail, (int)trainerStates.size());
+        for (auto& state : trainerStates) {
+            std::ostringstream random;
+            random << state->mt;
+            sv4d::utils::io::writeString(tail, random.str());
+            sv4d::utils::io::write(tail, state->negativePos);
+            sv4d::utils::io::write(tail, state->negativeRandom.state);
+            sv4d::utils::io::write(tail, state->roundingSeed);
+            sv4d::utils::io::write(tail, state->lr);
+            sv4d::utils::io::write(tail, state->temp);
+            sv4d::utils::io::writeVector(tail, state->dictPairPos);
+        }
+        out.tail = tail.str();
+        out.message = "\nCheckpoint: " + std::to_string(wordCount) + " words  \n";
+    }
 
-                // print log
-                auto now = std::chrono::system_clock::now();
-                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
-                float speed = trainedWordCount / (float)((elapsed + 1) * threadNum);
-                float eta = ((float)(epochs * vocab.totalWordsNum) / (trainedWordCount + 1) * elapsed - elapsed) / 60000.0f;
-                printf("%cAlpha: %f  Progress: %.2f%%  Words/thread/sec: %.2fk  Remaining: %.2fm  ", 13, lr, progress * 100.0f, speed, eta);
-                fflush(stdout);
+    const char* Model::writeCheckpoint() {
+        BackgroundWrite& out = backgroundWrite;
+        sv4d::utils::io::RawFile fout(out.buffer.data(), out.buffer.size());
+        if (!fout.open(out.tmpPath.c_str())) {
+            return "Cannot open checkpoint file";
+        }
+        fout.write(out.head.data(), out.head.size());
+        for (const sv4d::Matrix* matrix : {&senseSelectionOutWeight, &embeddingInWeight, &embeddingOutWeight}) {
+            fout.write(matrix->data, matrix->row * matrix->rowBytes);
+        }
+        fout.write(senseSelectionOutBias.data, senseSelectionOutBias.col * sizeof(float));
+        fout.write(out.tail.data(), out.tail.size());
+        if (!fout.close()) {
+            return "Cannot write checkpoint file";
+        }
+        if (std::rename(out.tmpPath.c_str(), out.path.c_str()) != 0) {
+            return "Cannot replace checkpoint file";
+        }
+        return nullptr;
+    }
+
+    // Must follow initialize(), which it overrides; training() then
+    // continues from the checkpoint.
+    void Model::loadCheckpoint(const std::string& filepath) {
+        std::ifstream fin(filepath, std::ios::in | std::ios::binary);
+        if (fin.fail()) {
+            throw std::runtime_error("Cannot open checkpoint file");
+        }
+
+        char magic[sizeof(CheckpointMagic)];
+        fin.read(magic, sizeof(magic));
+        int sizes[5];
+        for (int& size : sizes) {
+            sv4d::utils::io::read(fin, size);
+        }
+        if (!fin || !std::equal(magic, magic + sizeof(magic), CheckpointMagic)) {
+            throw std::runtime_error("Invalid checkpoint file");
+        }
+        if (sizes[0] != vocab.lemmaVocabSize || sizes[1] != vocab.synsetVocabSize || sizes[2] != vocab.wordVocabSize || sizes[3] != embeddingLayerSize || sizes[4] != (int)storagePrecision) {
+            throw std::runtime_error("Checkpoint does not match the vocab, -embedding_layer_size or -storage_precision");
+        }
+
+        for (sv4d::Matrix* matrix : {&senseSelectionOutWeight, &embeddingInWeight, &embeddingOutWeight}) {
+            fin.read((char*)matrix->data, matrix->row * matrix->rowBytes);
+        }
+        fin.read((char*)senseSelectionOutBias.data, senseSelectionOutBias.col * sizeof(float));
+        long wordCount = 0;
+        sv4d::utils::io::read(fin, wordCount);
+        trainedWordCount = wordCount;
+
+        // the vocab file does not keep the order of senses and parts of
+        // speech that training used
+        for (std::vector<int>* array : {&compiledVocab.senseOffsets, &compiledVocab.senseLemmas, &compiledVocab.senseSynsets, &compiledVocab.validPosOffsets, &compiledVocab.validPos, &compiledVocab.wordSynsets, &compiledVocab.dictPairOffsets, &compiledVocab.dictPairs}) {
+            sv4d::utils::io::readVector(fin, *array);
+        }
+        sv4d::utils::io::read(fin, compiledVocab.maxSenseNum);
+
+        auto chunks = std::vector<sv4d::CorpusChunk>();
+        sv4d::utils::io::readVector(fin, chunks);
+        int workerNum = readerThreadNum > 0 ? readerThreadNum : threadNum;
+        scheduler = std::unique_ptr<sv4d::ChunkScheduler>(new sv4d::ChunkScheduler(chunks, workerNum, epochs, !deterministic));
+        scheduler->load(fin);
+
+        int readerNum = 0;
+        sv4d::utils::io::read(fin, readerNum);
+        readerRandoms.resize(readerNum);
+        for (auto& random : readerRandoms) {
+            std::string buffer;
+            sv4d::utils::io::readString(fin, buffer);
+            std::istringstream(buffer) >> random;
+        }
+        int trainerNum = 0;
+        sv4d::utils::io::read(fin, trainerNum);
+        trainerStates.clear();
+        for (int i = 0; i < trainerNum && fin; ++i) {
+            auto state = std::unique_ptr<TrainerState>(new TrainerState(i, vocab.synsetVocabSize, initialLearningRate, initialTemperature));
+            std::string buffer;
+            sv4d::utils::io::readString(fin, buffer);
+            std::istringstream(buffer) >> state->mt;
+            sv4d::utils::io::read(fin, state->negativePos);
+            sv4d::utils::io::read(fin, state->negativeRandom.state);
+            sv4d::utils::io::read(fin, state->roundingSeed);
+            sv4d::utils::io::read(fin, state->lr);
+            sv4d::utils::io::read(fin, state->temp);
+            sv4d::utils::io::readVector(fin, state->dictPairPos);
+            if ((int)state->dictPairPos.size() != vocab.synsetVocabSize) {
+                throw std::runtime_error("Invalid checkpoint file");
             }
+            trainerStates.push_back(std::move(state));
+        }
+        if (!fin) {
+            throw std::runtime_error("Truncated checkpoint file");
         }
+        printf("Resumed from checkpoint: %ld words  \n", wordCount);
     }
 
-    void Model::wordNearestNeighbour() {
-        sv4d::Matrix normedEmbeddingInWeight = sv4d::Matrix(embeddingInWeight);
-        for (int i = 0; i < normedEmbeddingInWeight.row; ++i) {
-            float norm = (normedEmbeddingInWeight[i] * normedEmbeddingInWeight[i]).sum();
-            normedEmbeddingInWeight[i] /= std::sqrt(norm);
+    void Model::initializeNeighbourIndex() {
+        if (!quantizeNeighbour) {
+            normedEmbeddingInWeight = sv4d::Matrix(embeddingInWeight.row, embeddingInWeight.col);
+            for (int i = 0; i < normedEmbeddingInWeight.row; ++i) {
+                normedEmbeddingInWeight[i].assign(embeddingInWeight[i]);
+                float norm = normedEmbeddingInWeight[i].squaredNorm();
+                normedEmbeddingInWeight[i] /= std::sqrt(norm);
+            }
+            printf("Neighbour index: fp32  %.2fMB  \n", normedEmbeddingInWeight.bytes() / 1048576.0);
+            return;
+        }
+
+        quantizedEmbeddingInWeight = sv4d::QuantizedMatrix(embeddingInWeight.row, embeddingInWeight.col);
+        embeddingInInverseNorms = std::vector<float>(embeddingInWeight.row);
+        sv4d::Vector rowBuffer = sv4d::Vector(embeddingInWeight.col);
+        for (int i = 0; i < embeddingInWeight.row; ++i) {
+            rowBuffer.assign(embeddingInWeight[i]);
+            embeddingInInverseNorms[i] = 1.0f / std::sqrt(rowBuffer.squaredNorm());
+            rowBuffer *= embeddingInInverseNorms[i];
+            quantizedEmbeddingInWeight.quantize(i, rowBuffer);
+        }
+        if (rerankSize <= 0) {
+            embeddingInWeight = sv4d::Matrix();
+        }
+        printf("Neighbour index: int8  %.2fMB  \n", quantizedEmbeddingInWeight.bytes() / 1048576.0);
+    }
+
+    // Returns the k rows closest to row idx by cosine similarity. With a
+    // quantized index the int8 scores preselect max(k, rerankSize) candidates
+    // whose similarity is then recomputed from the stored weights.
+    std::vector<std::pair<int, float>> Model::nearestNeighbours(int idx, int k) {
+        auto similarities = std::vector<std::pair<int, float>>();
+        int rowNum = quantizeNeighbour ? quantizedEmbeddingInWeight.row : normedEmbeddingInWeight.row;
+        similarities.reserve(rowNum);
+        for (int i = 0; i < rowNum; ++i) {
+            if (i == idx) {
+                continue;
+            }
+            std::pair<int, float> pair;
+            pair.first = i;
+            if (quantizeNeighbour) {
+                pair.second = quantizedEmbeddingInWeight.dot(idx, i);
+            } else {
+                pair.second = normedEmbeddingInWeight[idx] % normedEmbeddingInWeight[i];
+            }
+            similarities.push_back(pair);
+        }
+
+        auto compare = [](const std::pair<int, float> & a, const std::pair<int, float> & b) -> bool { return a.second > b.second; };
+        if (quantizeNeighbour && rerankSize > 0) {
+            int candidateNum = std::min((int)similarities.size(), std::max(k, rerankSize));
+            std::partial_sort(similarities.begin(), similarities.begin() + candidateNum, similarities.end(), compare);
+            similarities.resize(candidateNum);
+            auto vector = embeddingInWeight[idx];
+            for (auto& pair : similarities) {
+                pair.second = (vector % embeddingInWeight[pair.first]) * embeddingInInverseNorms[idx] * embeddingInInverseNorms[pair.first];
+            }
         }
 
+        int resultNum = std::min((int)similarities.size(), k);
+        std::partial_sort(similarities.begin(), similarities.begin() + resultNum, similarities.end(), compare);
+        similarities.resize(resultNum);
+        return similarities;
+    }
+
+    void Model::wordNearestNeighbour() {
+        initializeNeighbourIndex();
+
         while (true) {
             printf("Enter word (EXIT to break): ");
             std::string word = "";
@@ -641,21 +1943,10 @@ namespace sv4d {
                 continue;
             }
             int widx = vocab.synsetVocab[word];
-            auto& wordVector = normedEmbeddingInWeight[widx];
-            auto similarities = std::vector<std::pair<int, float>>();
-            for (int i = 0; i < normedEmbeddingInWeight.row; ++i) {
-                if (i == widx) {
-                    continue;
-                }
-                std::pair<int, float> pair;
-                pair.first = i;
-                pair.second = wordVector % normedEmbeddingInWeight[i];
-                similarities.push_back(pair);
-            }
-            std::sort(similarities.begin(), similarities.end(), [](const std::pair<int, float> & a, const std::pair<int, float> & b) -> bool { return a.second > b.second; });
+            auto similarities = nearestNeighbours(widx, 40);
             printf("Word %d: %s", widx, vocab.sidx2Synset[widx].c_str());
             printf("\n                                              Word       Cosine distance\n------------------------------------------------------------------------\n");
-            for (int i = 0; i < 40; ++i) {
+            for (size_t i = 0; i < similarities.size(); ++i) {
                 printf("%50s\t\t%f\n", vocab.sidx2Synset[similarities[i].first].c_str(), similarities[i].second);
             }
             printf("\n");
@@ -663,11 +1954,7 @@ namespace sv4d {
     }
 
     void Model::synsetNearestNeighbour() {
-        sv4d::Matrix normedEmbeddingInWeight = sv4d::Matrix(embeddingInWeight);
-        for (int i = 0; i < normedEmbeddingInWeight.row; ++i) {
-            float norm = (normedEmbeddingInWeight[i] * normedEmbeddingInWeight[i]).sum();
-            normedEmbeddingInWeight[i] /= std::sqrt(norm);
-        }
+        initializeNeighbourIndex();
 
         while (true) {
             printf("Enter word (EXIT to break): ");
@@ -695,23 +1982,11 @@ namespace sv4d {
                 std::sort(lemmas.begin(), lemmas.end());
                 for (int lidx : lemmas) {
                     int sidx = vocab.lidx2sidx[lidx];
-                    auto synsetVector = normedEmbeddingInWeight[sidx];
-
-                    auto similarities = std::vector<std::pair<int, float>>();
-                    for (int i = 0; i < normedEmbeddingInWeight.row; ++i) {
-                        if (i == sidx) {
-                            continue;
-                        }
-                        std::pair<int, float> pair;
-                        pair.first = i;
-                        pair.second = synsetVector % normedEmbeddingInWeight[i];
-                        similarities.push_back(pair);
-                    }
+                    auto similarities = nearestNeighbours(sidx, 20);
 
-                    std::sort(similarities.begin(), similarities.end(), [](const std::pair<int, float> & a, const std::pair<int, float> & b) -> bool { return a.second > b.second; });
                     printf("Synset %d: %s", sidx, vocab.sidx2Synset[sidx].c_str());
                     printf("\n                                              Word       Cosine distance\n------------------------------------------------------------------------\n");
-                    for (int i = 0; i < 20; ++i) {
+                    for (size_t i = 0; i < similarities.size(); ++i) {
                         printf("%50s\t\t%f\n", vocab.sidx2Synset[similarities[i].first].c_str(), similarities[i].second);
                     }
                     printf("\n");
@@ -726,16 +2001,16 @@ namespace sv4d {
             throw std::runtime_error("Cannot open weight file");
         }
         fout << vocab.synsetVocabSize << " " << embeddingLayerSize << "\n";
+        sv4d::Vector rowBuffer = sv4d::Vector(embeddingLayerSize);
         for (int sidx = 0; sidx < vocab.synsetVocabSize; ++sidx) {
             auto synset = vocab.sidx2Synset[sidx];
             fout << synset << " ";
-            auto& vector = embeddingInWeight[sidx].getData();
+            rowBuffer.assign(embeddingInWeight[sidx]);
+            auto vector = rowBuffer.getData();
             if (binary) {
-                for (int i = 0; i < embeddingLayerSize; ++i) {
-                    fout.write((char *)&vector[i], sizeof(float));
-                }
+                fout.write((char *)vector, embeddingLayerSize * sizeof(float));
             } else {
-                fout << sv4d::utils::string::join(sv4d::utils::string::floatvec_to_strvec(vector), ' ');
+                fout << sv4d::utils::string::join(sv4d::utils::string::floatvec_to_strvec(std::vector<float>(vector, vector + embeddingLayerSize)), ' ');
             }
             fout << "\n";
         }
@@ -752,27 +2027,29 @@ namespace sv4d {
         auto sizes = sv4d::utils::string::split(sv4d::utils::string::trim(linebuf), ' ');
         int synsetVocabSize = std::stoi(sizes[0]);
         int embeddingLayerSize = std::stoi(sizes[1]);
+        sv4d::Vector rowBuffer = sv4d::Vector(embeddingInWeight.col);
         for (int i = 0; i < synsetVocabSize; ++i) {
             std::getline(fin, linebuf, ' ');
             auto synset = sv4d::utils::string::trim(linebuf);
             if (vocab.synsetVocab.find(synset) == vocab.synsetVocab.end()) {
                 continue;
             }
-            auto& vector = embeddingInWeight[vocab.synsetVocab[synset]];
+            auto vector = embeddingInWeight[vocab.synsetVocab[synset]];
             if (binary) {
                 float value;
                 for (int i = 0; i < embeddingLayerSize; ++i) {
                     fin.read((char *)&value, sizeof(float));
-                    vector[i] = value;
+                    rowBuffer[i] = value;
                 }
                 fin.seekg(sizeof(char), fin.cur);
             } else {
                 std::getline(fin, linebuf, '\n');
                 auto strvec = sv4d::utils::string::split(sv4d::utils::string::trim(linebuf), ' ');
                 for (int i = 0; i < embeddingLayerSize; ++i) {
-                    vector[i] = std::stof(strvec[i]);
+                    rowBuffer[i] = std::stof(strvec[i]);
                 }
             }
+            vector.assign(rowBuffer);
         }
     }
 
@@ -782,16 +2059,16 @@ namespace sv4d {
             throw std::runtime_error("Cannot open weight file");
         }
         fout << vocab.wordVocabSize << " " << embeddingLayerSize << "\n";
+        sv4d::Vector rowBuffer = sv4d::Vector(embeddingLayerSize);
         for (int widx = 0; widx < vocab.wordVocabSize; ++widx) {
             auto word = vocab.sidx2Synset[widx];
             fout << word << " ";
-            auto& vector = embeddingOutWeight[widx].getData();
+            rowBuffer.assign(embeddingOutWeight[widx]);
+            auto vector = rowBuffer.getData();
             if (binary) {
-                for (int i = 0; i < embeddingLayerSize; ++i) {
-                    fout.write((char *)&vector[i], sizeof(float));
-                }
+                fout.write((char *)vector, embeddingLayerSize * sizeof(float));
             } else {
-                fout << sv4d::utils::string::join(sv4d::utils::string::floatvec_to_strvec(vector), ' ');
+                fout << sv4d::utils::string::join(sv4d::utils::string::floatvec_to_strvec(std::vector<float>(vector, vector + embeddingLayerSize)), ' ');
             }
             fout << "\n";
         }
@@ -808,27 +2085,29 @@ namespace sv4d {
         auto sizes = sv4d::utils::string::split(sv4d::utils::string::trim(linebuf), ' ');
         int wordVocabSize = std::stoi(sizes[0]);
         int embeddingLayerSize = std::stoi(sizes[1]);
+        sv4d::Vector rowBuffer = sv4d::Vector(embeddingOutWeight.col);
         for (int i = 0; i < wordVocabSize; ++i) {
             std::getline(fin, linebuf, ' ');
             auto word = sv4d::utils::string::trim(linebuf);
             if (vocab.synsetVocab.find(word) == vocab.synsetVocab.end()) {
                 continue;
             }
-            auto& vector = embeddingOutWeight[vocab.synsetVocab[word]];
+            auto vector = embeddingOutWeight[vocab.synsetVocab[word]];
             if (binary) {
                 float value;
                 for (int i = 0; i < embeddingLayerSize; ++i) {
                     fin.read((char *)&value, sizeof(float));
-                    vector[i] = value;
+                    rowBuffer[i] = value;
                 }
                 fin.seekg(sizeof(char), fin.cur);
             } else {
                 std::getline(fin, linebuf, '\n');
                 auto strvec = sv4d::utils::string::split(sv4d::utils::string::trim(linebuf), ' ');
                 for (int i = 0; i < embeddingLayerSize; ++i) {
-                    vector[i] = std::stof(strvec[i]);
+                    rowBuffer[i] = std::stof(strvec[i]);
                 }
             }
+            vector.assign(rowBuffer);
         }
     }
 
@@ -838,16 +2117,16 @@ namespace sv4d {
             throw std::runtime_error("Cannot open weight file");
         }
         fout << vocab.lemmaVocabSize << " " << (embeddingLayerSize * 3) << "\n";
+        sv4d::Vector rowBuffer = sv4d::Vector(embeddingLayerSize * 3);
         for (int lidx = 0; lidx < vocab.lemmaVocabSize; ++lidx) {
             auto lemma = vocab.lidx2Lemma[lidx];
             fout << lemma << " ";
-            auto& vector = senseSelectionOutWeight[lidx].getData();
+            rowBuffer.assign(senseSelectionOutWeight[lidx]);
+            auto vector = rowBuffer.getData();
             if (binary) {
-                for (int i = 0; i < embeddingLayerSize * 3; ++i) {
-                    fout.write((char *)&vector[i], sizeof(float));
-                }
+                fout.write((char *)vector, embeddingLayerSize * 3 * sizeof(float));
             } else {
-                fout << sv4d::utils::string::join(sv4d::utils::string::floatvec_to_strvec(vector), ' ');
+                fout << sv4d::utils::string::join(sv4d::utils::string::floatvec_to_strvec(std::vector<float>(vector, vector + embeddingLayerSize * 3)), ' ');
             }
             fout << "\n";
         }
@@ -864,27 +2143,29 @@ namespace sv4d {
         auto sizes = sv4d::utils::string::split(sv4d::utils::string::trim(linebuf), ' ');
         int lemmaVocabSize = std::stoi(sizes[0]);
         int embeddingLayerSize = std::stoi(sizes[1]);
+        sv4d::Vector rowBuffer = sv4d::Vector(senseSelectionOutWeight.col);
         for (int i = 0; i < lemmaVocabSize; ++i) {
             std::getline(fin, linebuf, ' ');
             auto lemma = sv4d::utils::string::trim(linebuf);
             if (vocab.lemmaVocab.find(lemma) == vocab.lemmaVocab.end()) {
                 continue;
             }
-            auto& vector = senseSelectionOutWeight[vocab.lemmaVocab[lemma]];
+            auto vector = senseSelectionOutWeight[vocab.lemmaVocab[lemma]];
             if (binary) {
                 float value;
                 for (int i = 0; i < embeddingLayerSize; ++i) {
                     fin.read((char *)&value, sizeof(float));
-                    vector[i] = value;
+                    rowBuffer[i] = value;
                 }
                 fin.seekg(sizeof(char), fin.cur);
             } else {
                 std::getline(fin, linebuf, '\n');
                 auto strvec = sv4d::utils::string::split(sv4d::utils::string::trim(linebuf), ' ');
                 for (int i = 0; i < embeddingLayerSize; ++i) {
-                    vector[i] = std::stof(strvec[i]);
+                    rowBuffer[i] = std::stof(strvec[i]);
                 }
             }
+            vector.assign(rowBuffer);
         }
     }
 
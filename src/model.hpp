@@ -4,11 +4,21 @@
 #include "vocab.hpp"
 #include "matrix.hpp"
 #include "vector.hpp"
+#include "kernel.hpp"
+#include "pipeline.hpp"
+#include "sampler.hpp"
+#include "telemetry.hpp"
+#include "utils.hpp"
 #include <string>
 #include <vector>
 #include <chrono>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <random>
+#include <cstdint>
 #include <cmath>
-#include <unordered_set>
+#include <utility>
 
 namespace sv4d {
 
@@ -17,9 +27,13 @@ namespace sv4d {
             Model(const sv4d::Options& opt, const sv4d::Vocab& v);
 
             sv4d::Vocab vocab;
+            sv4d::CompiledVocab compiledVocab;
 
             std::string trainingCorpus;
+            std::string compiledCorpus;
             std::string stopWordsFile;
+            std::string modelDir;
+            std::string checkpointFile;
 
             int epochs;
             int embeddingLayerSize;
@@ -30,8 +44,20 @@ namespace sv4d {
             int maxDictPair;
             int threadNum;
             int batchSize;
-
-            long fileSize;
+            int readerThreadNum;
+            int queueSize;
+            int chunksPerThread;
+            int contextRecomputeInterval;
+            int hotRows;
+            int hotRowSync;
+            bool deterministic;
+            long checkpointWords;
+            float checkpointMinutes;
+            long snapshotWords;
+            float snapshotMinutes;
+            std::string telemetry;
+            float telemetrySeconds;
+            bool binary;
 
             float subSamplingFactor;
             float initialLearningRate;
@@ -41,18 +67,35 @@ namespace sv4d {
             float betaDict;
             float betaReward;
 
+            sv4d::kernel::Precision storagePrecision;
+            bool stochasticRounding;
+            bool sharedNegative;
+            std::string negativeSampler;
+            bool incrementalContext;
+            bool cachedReward;
+            bool quantizeNeighbour;
+            int rerankSize;
+            int sigmoidTableSize;
+
             sv4d::Matrix senseSelectionOutWeight;
             sv4d::Vector senseSelectionOutBias;
             sv4d::Matrix embeddingInWeight;
             sv4d::Matrix embeddingOutWeight;
 
-            std::vector<int> unigramTable;
+            std::vector<int, sv4d::utils::memory::LargeAllocator<int>> unigramTable;
+            sv4d::AliasSampler aliasSampler;
             std::vector<float> subsamplingFactorTable;
-            std::unordered_set<int> stopWords;
+            // indexed by synset index
+            std::vector<bool> stopWords;
 
             void initialize();
             void training();
-            void trainingThread(const int threadId);
+            void readerThread(const int readerId, sv4d::Pipeline* pipeline, sv4d::BatchReader* reader);
+            void trainingThread(const int threadId, sv4d::Pipeline* pipeline, sv4d::BatchReader* reader);
+            void reporterThread(sv4d::Pipeline* pipeline);
+            void saveCheckpoint(const std::string& filepath);
+            void loadCheckpoint(const std::string& filepath);
+            void saveSnapshot(const std::string& dirpath);
             void wordNearestNeighbour();
             void synsetNearestNeighbour();
             void saveEmbeddingInWeight(const std::string& filepath, bool binary);
@@ -67,15 +110,97 @@ namespace sv4d {
         private:
             static const int UnigramTableSize = 1e8;
 
-            long trainedWordCount;
+            // Random and schedule state of one training thread. It lives in
+            // the model so that a checkpoint can save it while the thread
+            // waits for a batch.
+            struct TrainerState {
+                TrainerState(int threadId, int synsetVocabSize, float lr, float temp);
+
+                std::mt19937 mt;
+                int negativePos;
+                sv4d::FastRandom negativeRandom;
+                uint32_t roundingSeed;
+                float lr;
+                float temp;
+                std::vector<int> dictPairPos;
+            };
+
+            // Rows changed by one trainer in the current round with
+            // deterministic.
+            struct RoundCopies {
+                RoundCopies(const sv4d::Vocab& vocab, int embeddingLayerSize);
+
+                sv4d::RowCopies senseSelectionOut;
+                sv4d::RowCopies senseSelectionBias;
+                sv4d::RowCopies embeddingIn;
+                sv4d::RowCopies embeddingOut;
+            };
+
+            std::atomic<long> trainedWordCount;
+            long startWordCount;
+
+            // training position; restored by loadCheckpoint
+            std::unique_ptr<sv4d::ChunkScheduler> scheduler;
+            std::vector<std::unique_ptr<sv4d::BatchReader>> batchReaders;
+            std::vector<std::mt19937> readerRandoms;
+            std::vector<std::unique_ptr<TrainerState>> trainerStates;
+            std::atomic<int> finishedTrainerNum;
+            std::vector<std::unique_ptr<RoundCopies>> roundCopies;
+            std::vector<std::unique_ptr<sv4d::telemetry::ThreadCounters>> trainerCounters;
+            std::unique_ptr<sv4d::Barrier> roundBarrier;
+            // A checkpoint or snapshot for the forked writer, laid out by the
+            // parent: the child of a threaded process must not allocate or
+            // take locks, so it only copies the weights through buffer and
+            // writes with write(2).
+            struct BackgroundWrite {
+                // checkpoint file or snapshot directory, and its temporary
+                std::string path;
+                std::string tmpPath;
+                // checkpoint fields before and after the weights
+                std::string head;
+                std::string tail;
+                // snapshot: the vocab saved with the model, the files in
+                // tmpPath and the text of the bias file
+                std::string vocabPath;
+                std::vector<std::string> files;
+                std::string biasText;
+                std::vector<char> buffer;
+                sv4d::Vector row;
+                // printed once the write succeeded
+                std::string message;
+            };
+            BackgroundWrite backgroundWrite;
+            // pid of the forked child writing a checkpoint or snapshot
+            int backgroundWriter;
+            std::chrono::steady_clock::time_point backgroundWriterStart;
+            int backgroundWriterWarnings;
+
+            void printProgress(sv4d::Pipeline* pipeline);
+            void exportTelemetry(const std::string& filepath);
+
+            void prepareCheckpoint(const std::string& filepath);
+            const char* writeCheckpoint();
+            void prepareSnapshot(const std::string& dirpath);
+            const char* writeSnapshot();
+            const char* writeRows(const std::string& filepath, const sv4d::Matrix& matrix, const std::vector<std::string>& names);
+            void writeInBackground(const std::function<const char*()>& write);
+            bool reapBackgroundWriter(bool wait);
 
             std::chrono::system_clock::time_point startTime;
 
+            sv4d::Matrix normedEmbeddingInWeight;
+            sv4d::QuantizedMatrix quantizedEmbeddingInWeight;
+            std::vector<float> embeddingInInverseNorms;
+
             void initializeWeight();
-            void initializeUnigramTable();
+            void initializeNegativeSampler();
             void initializeSubsamplingFactorTable();
-            void initializeFileSize();
             void initializeStopWords();
+            void initializeNeighbourIndex();
+
+            bool readBatch(sv4d::BatchReader& reader, sv4d::TrainingBatch& batch);
+
+            std::vector<std::pair<int, float>> nearestNeighbours(int idx, int k);
 
             void saveMatrix(const sv4d::Matrix& matrix, const std::string& filepath, bool binary);
             void loadMatrix(sv4d::Matrix& matrix, const std::string& filepath, bool binary);
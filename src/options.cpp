@@ -5,6 +5,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <cstdlib>
+#include <algorithm>
 
 namespace sv4d {
 
@@ -12,7 +13,13 @@ namespace sv4d {
         modelDir = "./";
         synsetDataFile = "./synset.txt";
         trainingCorpus = "./corpus.txt";
+        compiledCorpus = "";
         stopWordsFile = "./stopwords.txt";
+        storagePrecision = "fp32";
+        numa = "off";
+        hugePages = "off";
+        negativeSampler = "alias";
+        telemetry = "off";
 
         epochs = 10;
         embeddingLayerSize = 300;
@@ -24,6 +31,16 @@ namespace sv4d {
         maxDictPair = 15;
         threadNum = 12;
         batchSize = 256;
+        // a quarter of threadNum unless given, see parse
+        readerThreadNum = threadNum / 4;
+        queueSize = 16;
+        chunksPerThread = 16;
+        contextRecomputeInterval = 64;
+        telemetrySeconds = 10;
+        hotRows = 0;
+        hotRowSync = 256;
+        rerankSize = 100;
+        sigmoidTableSize = 1024;
 
         subSamplingFactor = 1e-4;
         initialLearningRate = 0.025;
@@ -34,9 +51,21 @@ namespace sv4d {
         betaReward = 1.00;
 
         binary = true;
+        stochasticRounding = false;
+        sharedNegative = false;
+        incrementalContext = false;
+        deterministic = false;
+        cachedReward = false;
+        checkpointWords = 0;
+        checkpointMinutes = 0.0f;
+        snapshotWords = 0;
+        snapshotMinutes = 0.0f;
+        resume = false;
+        quantizeNeighbour = false;
     }
 
     void Options::parse(const std::vector<std::string>& args) {
+        bool readerThreadNumGiven = false;
         for (int i = 2; i < args.size(); i += 2) {
             if (args[i][0] != '-') {
                 throw std::runtime_error("Provided argument without a dash");
@@ -54,6 +83,8 @@ namespace sv4d {
                     synsetDataFile = std::string(args.at(i + 1));
                 } else if (args[i] == "-training_corpus") {
                     trainingCorpus = std::string(args.at(i + 1));
+                } else if (args[i] == "-compiled_corpus") {
+                    compiledCorpus = std::string(args.at(i + 1));
                 } else if (args[i] == "-stop_words_file") {
                     stopWordsFile = std::string(args.at(i + 1));
                 } else if (args[i] == "-epochs") {
@@ -74,6 +105,22 @@ namespace sv4d {
                     wsdWindowSize = std::stoi(args.at(i + 1));
                 } else if (args[i] == "-thread_num") {
                     threadNum = std::stoi(args.at(i + 1));
+                } else if (args[i] == "-reader_thread_num") {
+                    readerThreadNum = std::stoi(args.at(i + 1));
+                    readerThreadNumGiven = true;
+                    if (readerThreadNum < 0) {
+                        throw std::runtime_error("-reader_thread_num must not be negative");
+                    }
+                } else if (args[i] == "-queue_size") {
+                    queueSize = std::stoi(args.at(i + 1));
+                    if (queueSize < 1) {
+                        throw std::runtime_error("-queue_size must be at least 1");
+                    }
+                } else if (args[i] == "-chunks_per_thread") {
+                    chunksPerThread = std::stoi(args.at(i + 1));
+                    if (chunksPerThread < 1) {
+                        throw std::runtime_error("-chunks_per_thread must be at least 1");
+                    }
                 } else if (args[i] == "-sub_sampling_factor") {
                     subSamplingFactor = std::stof(args.at(i + 1));
                 } else if (args[i] == "-initial_learning_rate") {
@@ -90,11 +137,106 @@ namespace sv4d {
                     betaReward = std::stof(args.at(i + 1));
                 } else if (args[i] == "-binary") {
                     binary = (std::stoi(args.at(i + 1)) == 1);
+                } else if (args[i] == "-storage_precision") {
+                    storagePrecision = std::string(args.at(i + 1));
+                    if (storagePrecision != "fp32" && storagePrecision != "bf16" && storagePrecision != "fp16") {
+                        throw std::runtime_error("-storage_precision must be one of fp32, bf16 or fp16");
+                    }
+                } else if (args[i] == "-stochastic_rounding") {
+                    stochasticRounding = (std::stoi(args.at(i + 1)) == 1);
+                } else if (args[i] == "-shared_negative") {
+                    sharedNegative = (std::stoi(args.at(i + 1)) == 1);
+                } else if (args[i] == "-incremental_context") {
+                    incrementalContext = (std::stoi(args.at(i + 1)) == 1);
+                } else if (args[i] == "-context_recompute_interval") {
+                    contextRecomputeInterval = std::stoi(args.at(i + 1));
+                    if (contextRecomputeInterval < 1) {
+                        throw std::runtime_error("-context_recompute_interval must be at least 1");
+                    }
+                } else if (args[i] == "-hot_rows") {
+                    hotRows = std::stoi(args.at(i + 1));
+                    if (hotRows < 0) {
+                        throw std::runtime_error("-hot_rows must not be negative");
+                    }
+                } else if (args[i] == "-hot_row_sync") {
+                    hotRowSync = std::stoi(args.at(i + 1));
+                    if (hotRowSync < 1) {
+                        throw std::runtime_error("-hot_row_sync must be at least 1");
+                    }
+                } else if (args[i] == "-deterministic") {
+                    deterministic = (std::stoi(args.at(i + 1)) == 1);
+                } else if (args[i] == "-cached_reward") {
+                    cachedReward = (std::stoi(args.at(i + 1)) == 1);
+                } else if (args[i] == "-negative_sampler") {
+                    negativeSampler = std::string(args.at(i + 1));
+                    if (negativeSampler != "alias" && negativeSampler != "table") {
+                        throw std::runtime_error("-negative_sampler must be alias or table");
+                    }
+                } else if (args[i] == "-checkpoint_words") {
+                    checkpointWords = std::stol(args.at(i + 1));
+                    if (checkpointWords < 0) {
+                        throw std::runtime_error("-checkpoint_words must not be negative");
+                    }
+                } else if (args[i] == "-checkpoint_minutes") {
+                    checkpointMinutes = std::stof(args.at(i + 1));
+                    if (checkpointMinutes < 0) {
+                        throw std::runtime_error("-checkpoint_minutes must not be negative");
+                    }
+                } else if (args[i] == "-snapshot_words") {
+                    snapshotWords = std::stol(args.at(i + 1));
+                    if (snapshotWords < 0) {
+                        throw std::runtime_error("-snapshot_words must not be negative");
+                    }
+                } else if (args[i] == "-snapshot_minutes") {
+                    snapshotMinutes = std::stof(args.at(i + 1));
+                    if (snapshotMinutes < 0) {
+                        throw std::runtime_error("-snapshot_minutes must not be negative");
+                    }
+                } else if (args[i] == "-telemetry") {
+                    telemetry = std::string(args.at(i + 1));
+                    if (telemetry != "off" && telemetry != "json" && telemetry != "prometheus") {
+                        throw std::runtime_error("-telemetry must be one of off, json or prometheus");
+                    }
+                } else if (args[i] == "-telemetry_seconds") {
+                    telemetrySeconds = std::stof(args.at(i + 1));
+                    if (!(telemetrySeconds > 0)) {
+                        throw std::runtime_error("-telemetry_seconds must be positive");
+                    }
+                } else if (args[i] == "-resume") {
+                    resume = (std::stoi(args.at(i + 1)) == 1);
+                } else if (args[i] == "-numa") {
+                    numa = std::string(args.at(i + 1));
+                    if (numa != "off" && numa != "local" && numa != "interleave") {
+                        throw std::runtime_error("-numa must be one of off, local or interleave");
+                    }
+                } else if (args[i] == "-huge_pages") {
+                    hugePages = std::string(args.at(i + 1));
+                    if (hugePages != "off" && hugePages != "transparent" && hugePages != "explicit") {
+                        throw std::runtime_error("-huge_pages must be one of off, transparent or explicit");
+                    }
+                } else if (args[i] == "-quantize_neighbour") {
+                    quantizeNeighbour = (std::stoi(args.at(i + 1)) == 1);
+                } else if (args[i] == "-rerank_size") {
+                    rerankSize = std::stoi(args.at(i + 1));
+                } else if (args[i] == "-sigmoid_table_size") {
+                    sigmoidTableSize = std::stoi(args.at(i + 1));
+                    if (sigmoidTableSize < 2) {
+                        throw std::runtime_error("-sigmoid_table_size must be at least 2");
+                    }
                 }
             } catch (std::out_of_range) {
                 throw std::runtime_error(args[i] + " is missing an argument");
             }
         }
+        // one reader keeps up with about four trainers
+        if (!readerThreadNumGiven) {
+            readerThreadNum = std::max(1, threadNum / 4);
+        }
+        // checkpoints park the workers between chunks, which deterministic
+        // rounds do not allow
+        if (deterministic && (checkpointWords > 0 || checkpointMinutes > 0 || resume)) {
+            throw std::runtime_error("-deterministic cannot be used with checkpoints or -resume");
+        }
     }
 
 }
\ No newline at end of file
@@ -12,7 +12,13 @@ namespace sv4d {
             std::string modelDir;
             std::string synsetDataFile;
             std::string trainingCorpus;
+            std::string compiledCorpus;
             std::string stopWordsFile;
+            std::string storagePrecision;
+            std::string numa;
+            std::string hugePages;
+            std::string negativeSampler;
+            std::string telemetry;
 
             int epochs;
             int embeddingLayerSize;
@@ -23,7 +29,20 @@ namespace sv4d {
             int maxDictPair;
             int threadNum;
             int batchSize;
+            int readerThreadNum;
+            int queueSize;
+            int chunksPerThread;
+            int contextRecomputeInterval;
+            int hotRows;
+            int hotRowSync;
+            long checkpointWords;
+            float checkpointMinutes;
+            long snapshotWords;
+            float snapshotMinutes;
+            float telemetrySeconds;
             int wsdWindowSize;
+            int rerankSize;
+            int sigmoidTableSize;
 
             float subSamplingFactor;
             float initialLearningRate;
@@ -34,6 +53,13 @@ namespace sv4d {
             float betaReward;
 
             bool binary;
+            bool stochasticRounding;
+            bool sharedNegative;
+            bool incrementalContext;
+            bool cachedReward;
+            bool deterministic;
+            bool resume;
+            bool quantizeNeighbour;
 
             void parse(const std::vector<std::string>& args);
     };
@@ -0,0 +1,352 @@
+#include "pipeline.hpp"
+
+#include "utils.hpp"
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+
+namespace sv4d {
+
+    ChunkScheduler::ChunkScheduler(const std::vector<sv4d::CorpusChunk>& chunks, int workerNum, int epochs, bool stealing) : chunks(chunks), remaining(0), epochs(epochs), epoch(-1), stealing(stealing), workerEpochs(workerNum, 0), paused(false), parkedNum(0), activeNum(workerNum) {
+        for (int i = 0; i < workerNum; ++i) {
+            queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+        }
+        deal();
+    }
+
+    std::vector<int> ChunkScheduler::shuffled(int epoch) const {
+        auto order = std::vector<int>(chunks.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::mt19937 engine(495 + epoch);
+        std::shuffle(order.begin(), order.end(), engine);
+        return order;
+    }
+
+    void ChunkScheduler::deal() {
+        epoch += 1;
+        if (epoch >= epochs) {
+            return;
+        }
+        auto order = shuffled(epoch);
+
+        remaining = order.size();
+        for (size_t i = 0; i < order.size(); ++i) {
+            WorkQueue& queue = *queues[i % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.chunks.push_back(order[i]);
+        }
+    }
+
+    // Deals a worker the chunks it would get in its next epoch.
+    void ChunkScheduler::dealShare(int workerId) {
+        workerEpochs[workerId] += 1;
+        auto order = shuffled(workerEpochs[workerId]);
+        WorkQueue& queue = *queues[workerId];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (size_t i = workerId; i < order.size(); i += queues.size()) {
+            queue.chunks.push_back(order[i]);
+            remaining += 1;
+        }
+    }
+
+    bool ChunkScheduler::take(int queueId, bool front, int& chunkId) {
+        WorkQueue& queue = *queues[queueId];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.chunks.empty()) {
+            return false;
+        }
+        if (front) {
+            chunkId = queue.chunks.front();
+            queue.chunks.pop_front();
+        } else {
+            chunkId = queue.chunks.back();
+            queue.chunks.pop_back();
+        }
+        remaining -= 1;
+        return true;
+    }
+
+    bool ChunkScheduler::next(int workerId, sv4d::CorpusChunk& chunk) {
+        {
+            std::unique_lock<std::mutex> lock(pauseMutex);
+            if (paused) {
+                parkedNum += 1;
+                pauseCondition.notify_all();
+                pauseCondition.wait(lock, [this] { return !paused; });
+                parkedNum -= 1;
+            }
+        }
+
+        int queueNum = queues.size();
+        int chunkId;
+        while (!stealing) {
+            if (take(workerId, true, chunkId)) {
+                chunk = chunks[chunkId];
+                return true;
+            }
+            if (workerEpochs[workerId] + 1 >= epochs) {
+                std::lock_guard<std::mutex> pauseLock(pauseMutex);
+                activeNum -= 1;
+                pauseCondition.notify_all();
+                return false;
+            }
+            dealShare(workerId);
+        }
+        while (true) {
+            if (take(workerId % queueNum, true, chunkId)) {
+                break;
+            }
+            bool stolen = false;
+            for (int i = 1; i < queueNum && !stolen; ++i) {
+                stolen = take((workerId + i) % queueNum, false, chunkId);
+            }
+            if (stolen) {
+                break;
+            }
+
+            std::lock_guard<std::mutex> lock(epochMutex);
+            if (remaining > 0) {
+                // a deal is in progress
+                continue;
+            }
+            if (epoch + 1 >= epochs) {
+                std::lock_guard<std::mutex> pauseLock(pauseMutex);
+                activeNum -= 1;
+                pauseCondition.notify_all();
+                return false;
+            }
+            deal();
+        }
+        chunk = chunks[chunkId];
+        return true;
+    }
+
+    void ChunkScheduler::pause() {
+        std::lock_guard<std::mutex> lock(pauseMutex);
+        paused = true;
+    }
+
+    bool ChunkScheduler::waitParked() {
+        std::unique_lock<std::mutex> lock(pauseMutex);
+        pauseCondition.wait(lock, [this] { return parkedNum == activeNum; });
+        return activeNum > 0;
+    }
+
+    void ChunkScheduler::resume() {
+        std::lock_guard<std::mutex> lock(pauseMutex);
+        paused = false;
+        pauseCondition.notify_all();
+    }
+
+    const std::vector<sv4d::CorpusChunk>& ChunkScheduler::getChunks() const {
+        return chunks;
+    }
+
+    void ChunkScheduler::save(std::ostream& out) const {
+        sv4d::utils::io::write(out, epoch);
+        sv4d::utils::io::write(out, (int)stealing);
+        sv4d::utils::io::writeVector(out, workerEpochs);
+        sv4d::utils::io::write(out, (int)queues.size());
+        for (auto& queue : queues) {
+            sv4d::utils::io::writeVector(out, std::vector<int>(queue->chunks.begin(), queue->chunks.end()));
+        }
+    }
+
+    void ChunkScheduler::load(std::istream& in) {
+        int queueNum = 0;
+        int savedStealing = 0;
+        auto savedWorkerEpochs = std::vector<int>();
+        sv4d::utils::io::read(in, epoch);
+        sv4d::utils::io::read(in, savedStealing);
+        sv4d::utils::io::readVector(in, savedWorkerEpochs);
+        sv4d::utils::io::read(in, queueNum);
+        if ((bool)savedStealing != stealing) {
+            throw std::runtime_error("Checkpoint was saved with another chunk scheduling");
+        }
+        // a worker's share of an epoch is fixed by its id, so the shares
+        // cannot be dealt over another number of workers
+        if (!stealing && (queueNum != (int)queues.size() || savedWorkerEpochs.size() != queues.size())) {
+            throw std::runtime_error("Checkpoint was saved with another number of workers");
+        }
+        auto savedQueues = std::vector<std::vector<int>>(queueNum);
+        for (auto& savedQueue : savedQueues) {
+            sv4d::utils::io::readVector(in, savedQueue);
+            for (int chunkId : savedQueue) {
+                if (chunkId < 0 || chunkId >= (int)chunks.size()) {
+                    throw std::runtime_error("Invalid chunk in checkpoint");
+                }
+            }
+        }
+
+        if (!stealing) {
+            workerEpochs = savedWorkerEpochs;
+        }
+        remaining = 0;
+        for (auto& queue : queues) {
+            queue->chunks.clear();
+        }
+        for (int i = 0; i < queueNum; ++i) {
+            for (size_t j = 0; j < savedQueues[i].size(); ++j) {
+                int queueId = queueNum == (int)queues.size() ? i : remaining % queues.size();
+                queues[queueId]->chunks.push_back(savedQueues[i][j]);
+                remaining += 1;
+            }
+        }
+    }
+
+    BatchReader::BatchReader(std::unique_ptr<sv4d::CorpusReader> corpus, sv4d::ChunkScheduler* scheduler, int workerId) : corpus(std::move(corpus)), scheduler(scheduler), mt(595 + workerId), workerId(workerId) {}
+
+    Barrier::Barrier(int threadNum) : threadNum(threadNum), arrivedNum(0), generation(0), flagged(false), result(false) {}
+
+    bool Barrier::wait(bool flag) {
+        std::unique_lock<std::mutex> lock(mutex);
+        flagged = flagged || flag;
+        arrivedNum += 1;
+        if (arrivedNum == threadNum) {
+            // no thread can arrive again before every waiter has read result
+            result = flagged;
+            flagged = false;
+            arrivedNum = 0;
+            generation += 1;
+            condition.notify_all();
+            return result;
+        }
+        long arrivedGeneration = generation;
+        condition.wait(lock, [this, arrivedGeneration] { return generation != arrivedGeneration; });
+        return result;
+    }
+
+    // yields before a waiting thread sleeps
+    const int SpinNum = 128;
+
+    Pipeline::Pipeline(int readerNum, int queueSize) : readerWaitNs(0), trainerWaitNs(0), occupancySum(0), popNum(0), inFlight(0), parkedReaders(0), parkedTrainers(0) {
+        for (int i = 0; i < readerNum; ++i) {
+            rings.push_back(std::unique_ptr<sv4d::BatchRing<sv4d::TrainingBatch>>(new sv4d::BatchRing<sv4d::TrainingBatch>(queueSize)));
+        }
+    }
+
+    // Sleeps until ready() holds. The fence pairs with the one in wake():
+    // either the waker sees parkedNum raised, or ready() sees its change.
+    template <class Ready>
+    void Pipeline::park(std::atomic<int>& parkedNum, std::condition_variable& condition, Ready ready) {
+        std::unique_lock<std::mutex> lock(parkMutex);
+        parkedNum += 1;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        condition.wait(lock, ready);
+        parkedNum -= 1;
+    }
+
+    void Pipeline::wake(std::atomic<int>& parkedNum, std::condition_variable& condition) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parkedNum.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(parkMutex);
+            condition.notify_all();
+        }
+    }
+
+    void Pipeline::push(int readerId, sv4d::TrainingBatch* batch) {
+        auto& ring = *rings[readerId];
+        inFlight += 1;
+        if (!ring.tryPush(batch)) {
+            auto start = std::chrono::steady_clock::now();
+            int spinNum = 0;
+            while (!ring.tryPush(batch)) {
+                if (spinNum < SpinNum) {
+                    spinNum += 1;
+                    std::this_thread::yield();
+                    continue;
+                }
+                park(parkedReaders, readerCondition, [&ring, batch] { return ring.tryPush(batch); });
+                break;
+            }
+            readerWaitNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+        wake(parkedTrainers, trainerCondition);
+    }
+
+    void Pipeline::close(int readerId) {
+        rings[readerId]->close();
+        wake(parkedTrainers, trainerCondition);
+    }
+
+    sv4d::TrainingBatch* Pipeline::pop(int trainerId) {
+        int ringNum = rings.size();
+        sv4d::TrainingBatch* batch = nullptr;
+        // true once a batch is taken or every ring is closed and drained
+        auto poll = [this, trainerId, ringNum, &batch] {
+            // read the closed flags before trying the rings so that a batch
+            // pushed just before closing is not missed
+            bool closed = true;
+            for (auto& ring : rings) {
+                closed = closed && ring->isClosed();
+            }
+            for (int i = 0; i < ringNum; ++i) {
+                if (rings[(trainerId + i) % ringNum]->tryPop(batch)) {
+                    return true;
+                }
+            }
+            return closed;
+        };
+        if (!poll()) {
+            auto start = std::chrono::steady_clock::now();
+            int spinNum = 0;
+            while (!poll()) {
+                if (spinNum < SpinNum) {
+                    spinNum += 1;
+                    std::this_thread::yield();
+                    continue;
+                }
+                park(parkedTrainers, trainerCondition, poll);
+                break;
+            }
+            trainerWaitNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+        if (batch != nullptr) {
+            occupancySum += occupancy() + 1;
+            popNum += 1;
+            wake(parkedReaders, readerCondition);
+        }
+        return batch;
+    }
+
+    void Pipeline::done() {
+        inFlight -= 1;
+    }
+
+    bool Pipeline::idle() const {
+        return inFlight.load() == 0;
+    }
+
+    int Pipeline::capacity() const {
+        int capacity = 0;
+        for (auto& ring : rings) {
+            capacity += ring->capacity();
+        }
+        return capacity;
+    }
+
+    int Pipeline::occupancy() const {
+        int occupancy = 0;
+        for (auto& ring : rings) {
+            occupancy += ring->size();
+        }
+        return occupancy;
+    }
+
+    double Pipeline::meanOccupancy() const {
+        long pops = popNum.load();
+        return pops == 0 ? 0.0 : occupancySum.load() / (double)pops;
+    }
+
+    double Pipeline::readerWaitSeconds() const {
+        return readerWaitNs.load() * 1e-9;
+    }
+
+    double Pipeline::trainerWaitSeconds() const {
+        return trainerWaitNs.load() * 1e-9;
+    }
+
+}
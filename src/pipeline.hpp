@@ -0,0 +1,262 @@
+#pragma once
+
+#include "corpus.hpp"
+#include "vector.hpp"
+#include "telemetry.hpp"
+#include <vector>
+#include <deque>
+#include <memory>
+#include <random>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <istream>
+#include <ostream>
+#include <cstddef>
+
+namespace sv4d {
+
+    // Consecutive sentences of one corpus chunk, ready for SGD. Sentences
+    // outside [begin, end) are only context for the document vector.
+    struct TrainingBatch {
+        std::vector<std::vector<int>> sentences;
+        std::vector<std::vector<char>> subSampled;
+        std::vector<sv4d::Vector> sentenceVectors;
+        int begin;
+        int end;
+        long wordCount;
+    };
+
+    // Hands out the corpus chunks of every epoch to workers. Each epoch the
+    // chunk order is shuffled and dealt round-robin into per-worker deques;
+    // a worker takes from the front of its own deque and, once it is empty,
+    // steals from the back of the others'. The next epoch is dealt when every
+    // chunk of the current one has been taken.
+    //
+    // Without stealing a worker only takes the chunks dealt to it, and deals
+    // itself its share of the next epoch once they are gone, so the chunks
+    // a worker trains do not depend on the timing of the others.
+    //
+    // For checkpoints the workers can be parked between chunks: after
+    // pause(), a worker asking for its next chunk waits in next() until
+    // resume(). Once every worker is parked, the chunks not yet taken are the
+    // whole position of training and can be saved.
+    class ChunkScheduler {
+        public:
+            ChunkScheduler(const std::vector<sv4d::CorpusChunk>& chunks, int workerNum, int epochs, bool stealing);
+
+            // False once every chunk of the last epoch has been taken.
+            bool next(int workerId, sv4d::CorpusChunk& chunk);
+
+            void pause();
+            // Blocks until every worker that has not run out of chunks is
+            // parked; false if none is left.
+            bool waitParked();
+            void resume();
+
+            const std::vector<sv4d::CorpusChunk>& getChunks() const;
+            // Epochs and untaken chunks; only while the workers are parked.
+            // When stealing, a state saved with another number of workers
+            // is dealt round-robin over the current ones.
+            void save(std::ostream& out) const;
+            void load(std::istream& in);
+
+        private:
+            struct WorkQueue {
+                std::mutex mutex;
+                std::deque<int> chunks;
+            };
+
+            std::vector<sv4d::CorpusChunk> chunks;
+            std::vector<std::unique_ptr<WorkQueue>> queues;
+            std::mutex epochMutex;
+            std::atomic<int> remaining;
+            int epochs;
+            int epoch;
+            bool stealing;
+            std::vector<int> workerEpochs;
+
+            std::mutex pauseMutex;
+            std::condition_variable pauseCondition;
+            bool paused;
+            int parkedNum;
+            int activeNum;
+
+            bool take(int queueId, bool front, int& chunkId);
+            std::vector<int> shuffled(int epoch) const;
+            void deal();
+            void dealShare(int workerId);
+    };
+
+    // State of the read / tokenize / subsample stage of one worker, kept
+    // across batches so that consecutive batches of a chunk share context.
+    struct BatchReader {
+        BatchReader(std::unique_ptr<sv4d::CorpusReader> corpus, sv4d::ChunkScheduler* scheduler, int workerId);
+
+        std::unique_ptr<sv4d::CorpusReader> corpus;
+        sv4d::ChunkScheduler* scheduler;
+        std::vector<int> sentenceBuffer;
+        std::deque<std::vector<int>> sentencesCache;
+        std::deque<std::vector<char>> subSampledCache;
+        std::deque<sv4d::Vector> sentenceVectorsCache;
+        std::mt19937 mt;
+        int workerId;
+        // counts of the batch being read, and the published totals
+        sv4d::telemetry::Counts counts;
+        sv4d::telemetry::ThreadCounters counters;
+    };
+
+    // Bounded lock-free ring with one producer and any number of consumers
+    // (Vyukov's bounded queue with the producer side simplified).
+    template <class T>
+    class BatchRing {
+        public:
+            BatchRing(size_t capacity) : mask(0), enqueuePos(0), dequeuePos(0), closed(false) {
+                // with a single cell a full ring looks empty to the producer
+                size_t size = 2;
+                while (size < capacity) {
+                    size *= 2;
+                }
+                mask = size - 1;
+                cells = std::unique_ptr<Cell[]>(new Cell[size]);
+                for (size_t i = 0; i < size; ++i) {
+                    cells[i].sequence.store(i, std::memory_order_relaxed);
+                    cells[i].item = nullptr;
+                }
+            }
+
+            // Only the producer may push; fails when the ring is full.
+            bool tryPush(T* item) {
+                size_t pos = enqueuePos.load(std::memory_order_relaxed);
+                Cell& cell = cells[pos & mask];
+                if (cell.sequence.load(std::memory_order_acquire) != pos) {
+                    return false;
+                }
+                cell.item = item;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                enqueuePos.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+            // Fails when the ring is empty.
+            bool tryPop(T*& item) {
+                size_t pos = dequeuePos.load(std::memory_order_relaxed);
+                while (true) {
+                    Cell& cell = cells[pos & mask];
+                    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                    std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(pos + 1);
+                    if (diff == 0) {
+                        if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                            item = cell.item;
+                            cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                            return true;
+                        }
+                    } else if (diff < 0) {
+                        return false;
+                    } else {
+                        pos = dequeuePos.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            size_t capacity() const {
+                return mask + 1;
+            }
+
+            // Approximate number of queued items.
+            size_t size() const {
+                size_t enqueued = enqueuePos.load(std::memory_order_acquire);
+                size_t dequeued = dequeuePos.load(std::memory_order_acquire);
+                return enqueued > dequeued ? enqueued - dequeued : 0;
+            }
+
+            void close() {
+                closed.store(true, std::memory_order_release);
+            }
+
+            bool isClosed() const {
+                return closed.load(std::memory_order_acquire);
+            }
+
+        private:
+            struct Cell {
+                std::atomic<size_t> sequence;
+                T* item;
+            };
+
+            std::unique_ptr<Cell[]> cells;
+            size_t mask;
+            char pad0[64];
+            std::atomic<size_t> enqueuePos;
+            char pad1[64];
+            std::atomic<size_t> dequeuePos;
+            char pad2[64];
+            std::atomic<bool> closed;
+    };
+
+    // Reusable barrier for a fixed number of threads. wait() returns once
+    // every thread has called it, and tells whether any of them passed true.
+    class Barrier {
+        public:
+            Barrier(int threadNum);
+
+            bool wait(bool flag);
+
+        private:
+            std::mutex mutex;
+            std::condition_variable condition;
+            int threadNum;
+            int arrivedNum;
+            long generation;
+            bool flagged;
+            bool result;
+    };
+
+    // Connects reader threads to trainer threads, one ring per reader.
+    // Trainers start at their own ring and take from the others when it is
+    // empty. Time spent waiting on full or empty rings and the ring
+    // occupancy seen by trainers are recorded to show which side is the
+    // bottleneck. A thread that has to wait yields for a while and then
+    // sleeps until a push, pop or close wakes it.
+    class Pipeline {
+        public:
+            Pipeline(int readerNum, int queueSize);
+
+            // Blocks while the reader's ring is full.
+            void push(int readerId, sv4d::TrainingBatch* batch);
+            void close(int readerId);
+            // Blocks until a batch is available; nullptr once every reader
+            // has closed and all rings are drained.
+            sv4d::TrainingBatch* pop(int trainerId);
+            // Called by a trainer once a popped batch is fully trained.
+            void done();
+            // No batch is queued or being trained.
+            bool idle() const;
+
+            int capacity() const;
+            // Batches currently queued over all rings.
+            int occupancy() const;
+            double meanOccupancy() const;
+            double readerWaitSeconds() const;
+            double trainerWaitSeconds() const;
+
+        private:
+            std::vector<std::unique_ptr<sv4d::BatchRing<sv4d::TrainingBatch>>> rings;
+            std::atomic<long> readerWaitNs;
+            std::atomic<long> trainerWaitNs;
+            std::atomic<long> occupancySum;
+            std::atomic<long> popNum;
+            std::atomic<long> inFlight;
+
+            std::mutex parkMutex;
+            std::condition_variable readerCondition;
+            std::condition_variable trainerCondition;
+            std::atomic<int> parkedReaders;
+            std::atomic<int> parkedTrainers;
+
+            template <class Ready>
+            void park(std::atomic<int>& parkedNum, std::condition_variable& condition, Ready ready);
+            void wake(std::atomic<int>& parkedNum, std::condition_variable& condition);
+    };
+
+}
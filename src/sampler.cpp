@@ -0,0 +1,58 @@
+#include "sampler.hpp"
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+namespace sv4d {
+
+    AliasSampler::AliasSampler() {
+        buckets = std::vector<Bucket>();
+    }
+
+    void AliasSampler::build(const std::vector<double>& weights) {
+        int n = weights.size();
+        double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+        if (n == 0 || total <= 0.0) {
+            throw std::runtime_error("Alias sampler needs a positive weight");
+        }
+
+        // scaled so that the mean bucket holds exactly 1
+        auto scaled = std::vector<double>(n);
+        auto small = std::vector<int>();
+        auto large = std::vector<int>();
+        for (int i = 0; i < n; ++i) {
+            scaled[i] = weights[i] * n / total;
+            if (scaled[i] < 1.0) {
+                small.push_back(i);
+            } else {
+                large.push_back(i);
+            }
+        }
+
+        // a full bucket is its own alias, so the threshold need not reach 2^32
+        buckets.assign(n, {UINT32_MAX, 0});
+        for (int i = 0; i < n; ++i) {
+            buckets[i].alias = i;
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back();
+            small.pop_back();
+            int l = large.back();
+            buckets[s].threshold = (uint32_t)std::min(scaled[s] * 4294967296.0, 4294967295.0);
+            buckets[s].alias = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // the rest are 1 up to rounding and stay full
+    }
+
+    size_t AliasSampler::bytes() const {
+        return buckets.size() * sizeof(Bucket);
+    }
+
+}
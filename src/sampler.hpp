@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace sv4d {
+
+    // xorshift64*, for draws in the training loop
+    struct FastRandom {
+        FastRandom(uint64_t seed) : state(seed != 0 ? seed : 495) {}
+
+        uint64_t operator()() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 2685821657736338717ULL;
+        }
+
+        uint64_t state;
+    };
+
+    // Walker's alias method (Vose's construction): draws index i with
+    // probability weights[i] / sum(weights) in O(1) from one 64-bit random
+    // number, using one bucket of O(V) memory per draw.
+    class AliasSampler {
+        public:
+            AliasSampler();
+
+            void build(const std::vector<double>& weights);
+
+            // The high 32 bits of r pick the bucket, the low 32 bits decide
+            // between the bucket and its alias.
+            int sample(uint64_t r) const {
+                uint32_t i = (uint32_t)(((r >> 32) * buckets.size()) >> 32);
+                const Bucket& bucket = buckets[i];
+                return (uint32_t)r < bucket.threshold ? (int)i : bucket.alias;
+            }
+
+            size_t bytes() const;
+
+        private:
+            struct Bucket {
+                uint32_t threshold;
+                int alias;
+            };
+
+            std::vector<Bucket> buckets;
+    };
+
+}
@@ -0,0 +1,138 @@
+#include "telemetry.hpp"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+namespace sv4d {
+
+    namespace telemetry {
+
+        static const char* CounterNames[CounterNum] = {
+            "words",
+            "subsampled_positions",
+            "trained_positions",
+            "senses",
+            "negatives",
+            "read_seconds",
+            "sentence_vector_seconds",
+            "sense_training_seconds",
+            "reward_seconds",
+            "word_training_seconds",
+        };
+
+        const char* counterName(Counter counter) {
+            return CounterNames[counter];
+        }
+
+        bool isTime(Counter counter) {
+            return counter >= Counter::Read;
+        }
+
+        Counts::Counts() {
+            for (int i = 0; i < CounterNum; ++i) {
+                values[i] = 0;
+            }
+        }
+
+        ThreadCounters::ThreadCounters() {
+            for (int i = 0; i < CounterNum; ++i) {
+                values[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void ThreadCounters::publish(Counts& counts) {
+            for (int i = 0; i < CounterNum; ++i) {
+                values[i].fetch_add(counts[i], std::memory_order_relaxed);
+                counts[i] = 0;
+            }
+        }
+
+        sv4d::telemetry::Counts ThreadCounters::read() const {
+            Counts counts;
+            for (int i = 0; i < CounterNum; ++i) {
+                counts[i] = values[i].load(std::memory_order_relaxed);
+            }
+            return counts;
+        }
+
+        static void writeValue(std::ostream& out, const Counts& counts, int counter) {
+            if (isTime((Counter)counter)) {
+                out << counts[counter] / 1e9;
+            } else {
+                out << counts[counter];
+            }
+        }
+
+        std::string formatJson(const Report& report) {
+            // totals per role, in order of first appearance
+            auto roles = std::vector<std::string>();
+            auto totals = std::vector<Counts>();
+            for (auto& thread : report.threads) {
+                size_t role = std::find(roles.begin(), roles.end(), thread.role) - roles.begin();
+                if (role == roles.size()) {
+                    roles.push_back(thread.role);
+                    totals.push_back(Counts());
+                }
+                for (int i = 0; i < CounterNum; ++i) {
+                    totals[role][i] += thread.counts[i];
+                }
+            }
+
+            std::ostringstream out;
+            out << "{\"elapsed_seconds\": " << report.elapsedSeconds << ", \"trained_words\": " << report.trainedWords
+                << ", \"words_per_second\": " << report.trainedWords / (report.elapsedSeconds + 1e-9)
+                << ", \"progress\": " << report.progress << ", \"learning_rate\": " << report.learningRate;
+            out << ", \"totals\": {";
+            for (size_t j = 0; j < roles.size(); ++j) {
+                out << (j > 0 ? ", " : "") << "\"" << roles[j] << "\": {";
+                for (int i = 0; i < CounterNum; ++i) {
+                    out << (i > 0 ? ", " : "") << "\"" << CounterNames[i] << "\": ";
+                    writeValue(out, totals[j], i);
+                }
+                out << "}";
+            }
+            out << "}, \"threads\": [";
+            for (size_t j = 0; j < report.threads.size(); ++j) {
+                const ThreadSample& thread = report.threads[j];
+                out << (j > 0 ? ", " : "") << "{\"role\": \"" << thread.role << "\", \"id\": " << thread.id;
+                for (int i = 0; i < CounterNum; ++i) {
+                    out << ", \"" << CounterNames[i] << "\": ";
+                    writeValue(out, thread.counts, i);
+                }
+                out << "}";
+            }
+            out << "]}";
+            return out.str();
+        }
+
+        std::string formatPrometheus(const Report& report) {
+            std::ostringstream out;
+            out << "# HELP sv4d_elapsed_seconds Time since training started.\n"
+                << "# TYPE sv4d_elapsed_seconds gauge\n"
+                << "sv4d_elapsed_seconds " << report.elapsedSeconds << "\n"
+                << "# HELP sv4d_trained_words_total Words trained over all threads and epochs.\n"
+                << "# TYPE sv4d_trained_words_total counter\n"
+                << "sv4d_trained_words_total " << report.trainedWords << "\n"
+                << "# HELP sv4d_progress Fraction of training done.\n"
+                << "# TYPE sv4d_progress gauge\n"
+                << "sv4d_progress " << report.progress << "\n"
+                << "# HELP sv4d_learning_rate Current learning rate.\n"
+                << "# TYPE sv4d_learning_rate gauge\n"
+                << "sv4d_learning_rate " << report.learningRate << "\n";
+            for (int i = 0; i < CounterNum; ++i) {
+                std::string name = std::string("sv4d_thread_") + CounterNames[i] + "_total";
+                out << "# TYPE " << name << " counter\n";
+                for (auto& thread : report.threads) {
+                    out << name << "{role=\"" << thread.role << "\",thread=\"" << thread.id << "\"} ";
+                    writeValue(out, thread.counts, i);
+                    out << "\n";
+                }
+            }
+            return out.str();
+        }
+
+    }
+
+}
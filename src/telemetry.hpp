@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+namespace sv4d {
+
+    namespace telemetry {
+
+        enum Counter {
+            Words = 0,
+            SubsampledPositions = 1,
+            TrainedPositions = 2,
+            Senses = 3,
+            Negatives = 4,
+            // time in ns
+            Read = 5,
+            SentenceVector = 6,
+            SenseTraining = 7,
+            Reward = 8,
+            WordTraining = 9,
+            CounterNum = 10,
+        };
+
+        // Name of a counter in the exports; times are exported in seconds.
+        const char* counterName(Counter counter);
+        bool isTime(Counter counter);
+
+        // Counts a thread accumulates without synchronization.
+        struct Counts {
+            Counts();
+
+            long values[CounterNum];
+
+            inline long& operator[](int counter) {
+                return values[counter];
+            }
+
+            inline long operator[](int counter) const {
+                return values[counter];
+            }
+        };
+
+        // Totals of one thread. The thread publishes its counts once per
+        // batch; the reporter reads the totals while training runs.
+        class ThreadCounters {
+            public:
+                ThreadCounters();
+
+                // Adds counts to the totals and zeroes them.
+                void publish(Counts& counts);
+                sv4d::telemetry::Counts read() const;
+
+            private:
+                std::atomic<long> values[CounterNum];
+                char pad[64];
+        };
+
+        struct ThreadSample {
+            std::string role;
+            int id;
+            sv4d::telemetry::Counts counts;
+        };
+
+        // Totals of every thread at one point of training.
+        struct Report {
+            double elapsedSeconds;
+            long trainedWords;
+            float progress;
+            float learningRate;
+            std::vector<sv4d::telemetry::ThreadSample> threads;
+        };
+
+        // One line of JSON, without the newline.
+        std::string formatJson(const sv4d::telemetry::Report& report);
+        // Prometheus text exposition format, for the node exporter's
+        // textfile collector.
+        std::string formatPrometheus(const sv4d::telemetry::Report& report);
+
+        inline long nowNs() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+    }
+
+}
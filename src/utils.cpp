@@ -1,6 +1,20 @@
 #include "utils.hpp"
 
 #include <cmath>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <new>
+#include <stdexcept>
+#include <fstream>
+#include <thread>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
 
 namespace sv4d {
@@ -13,13 +27,292 @@ namespace sv4d {
 
         namespace operation {
 
-            std::vector<float> computeSigmoidTable() {
-                auto table = std::vector<float>();
-                for (int i = 0; i < SigmoidTableSize + 1; ++i) {
-                    float x = (float)(i * 2 * MaxSigmoid) / SigmoidTableSize - MaxSigmoid;
-                    table.push_back(1.0 / (1.0 + std::exp(-x)));
+            std::vector<float> sigmoidTable;
+            std::vector<float> logSigmoidTable;
+            float sigmoidTableScale;
+
+            // The last entry is repeated so that lookups at exactly MaxSigmoid
+            // can interpolate with their right neighbour.
+            void setSigmoidTableSize(int size) {
+                if (size < 2) {
+                    throw std::runtime_error("Sigmoid table size must be at least 2");
+                }
+                sigmoidTable = std::vector<float>();
+                logSigmoidTable = std::vector<float>();
+                for (int i = 0; i < size + 2; ++i) {
+                    double x = (double)(std::min(i, size) * 2 * MaxSigmoid) / size - MaxSigmoid;
+                    sigmoidTable.push_back(1.0 / (1.0 + std::exp(-x)));
+                    logSigmoidTable.push_back(std::min(x, 0.0) - std::log1p(std::exp(-std::abs(x))));
+                }
+                sigmoidTableScale = size / (2 * MaxSigmoid);
+            }
+
+            namespace {
+
+                struct SigmoidTableInitializer {
+                    SigmoidTableInitializer() {
+                        setSigmoidTableSize(DefaultSigmoidTableSize);
+                    }
+                } sigmoidTableInitializer;
+
+            }
+
+        }
+
+        namespace memory {
+
+            void* alignedAlloc(size_t size) {
+                void* ptr = nullptr;
+                if (posix_memalign(&ptr, Alignment, alignedSize(size)) != 0) {
+                    throw std::bad_alloc();
+                }
+                return ptr;
+            }
+
+            void alignedFree(void* ptr) {
+                free(ptr);
+            }
+
+            namespace {
+
+                NumaPolicy numaPolicy = NumaPolicy::NumaOff;
+                HugePages hugePagesPolicy = HugePages::HugePagesOff;
+                int placementThreadNum = 1;
+
+                const int MpolInterleave = 3;
+
+                // Parses /sys/devices/system/node/online, e.g. "0-1,3".
+                std::vector<unsigned long> onlineNodeMask() {
+                    auto mask = std::vector<unsigned long>();
+                    std::ifstream fin("/sys/devices/system/node/online");
+                    std::string line;
+                    if (fin.fail() || !std::getline(fin, line)) {
+                        return mask;
+                    }
+                    const int bits = sizeof(unsigned long) * 8;
+                    for (auto range : sv4d::utils::string::split(sv4d::utils::string::trim(line), ',')) {
+                        auto bounds = sv4d::utils::string::split(range, '-');
+                        int first = std::stoi(bounds[0]);
+                        int last = bounds.size() > 1 ? std::stoi(bounds[1]) : first;
+                        for (int node = first; node <= last; ++node) {
+                            if (mask.size() <= (size_t)(node / bits)) {
+                                mask.resize(node / bits + 1, 0);
+                            }
+                            mask[node / bits] |= 1UL << (node % bits);
+                        }
+                    }
+                    return mask;
+                }
+
+                void interleave(void* ptr, size_t size) {
+                    auto mask = onlineNodeMask();
+                    // the kernel reads maxnode - 1 bits
+                    unsigned long maxnode = mask.size() * sizeof(unsigned long) * 8 + 1;
+                    if (mask.empty() || syscall(SYS_mbind, ptr, size, MpolInterleave, mask.data(), maxnode, 0) != 0) {
+                        printf("Warning: cannot interleave memory across NUMA nodes  \n");
+                    }
+                }
+
+                void touchParallel(void* ptr, size_t size, int threadNum) {
+                    size_t pages = (size + HugePageSize - 1) / HugePageSize;
+                    threadNum = std::max(1, std::min(threadNum, (int)pages));
+                    auto threads = std::vector<std::thread>();
+                    for (int i = 0; i < threadNum; ++i) {
+                        size_t begin = pages * i / threadNum * HugePageSize;
+                        size_t end = std::min(size, pages * (i + 1) / threadNum * HugePageSize);
+                        threads.push_back(std::thread([=]() {
+                            std::memset((char*)ptr + begin, 0, end - begin);
+                        }));
+                    }
+                    for (auto& thread : threads) {
+                        thread.join();
+                    }
+                }
+
+                void* mapAligned(size_t size) {
+                    if (hugePagesPolicy == HugePages::HugePagesExplicit) {
+                        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                        if (ptr != MAP_FAILED) {
+                            return ptr;
+                        }
+                        printf("Warning: no explicit huge pages available, falling back to transparent huge pages  \n");
+                        hugePagesPolicy = HugePages::HugePagesTransparent;
+                    }
+
+                    // over-allocate by one huge page and trim both ends
+                    size_t mapped = size + HugePageSize;
+                    char* base = (char*)mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    if (base == MAP_FAILED) {
+                        throw std::bad_alloc();
+                    }
+                    char* ptr = (char*)(((uintptr_t)base + HugePageSize - 1) / HugePageSize * HugePageSize);
+                    if (ptr > base) {
+                        munmap(base, ptr - base);
+                    }
+                    if (base + mapped > ptr + size) {
+                        munmap(ptr + size, base + mapped - (ptr + size));
+                    }
+                    if (hugePagesPolicy == HugePages::HugePagesTransparent) {
+                        madvise(ptr, size, MADV_HUGEPAGE);
+                    }
+                    return ptr;
+                }
+
+            }
+
+            NumaPolicy parseNumaPolicy(const std::string& name) {
+                if (name == "off") {
+                    return NumaPolicy::NumaOff;
+                } else if (name == "local") {
+                    return NumaPolicy::NumaLocal;
+                } else if (name == "interleave") {
+                    return NumaPolicy::NumaInterleave;
+                }
+                throw std::runtime_error("Unknown NUMA policy: " + name);
+            }
+
+            HugePages parseHugePages(const std::string& name) {
+                if (name == "off") {
+                    return HugePages::HugePagesOff;
+                } else if (name == "transparent") {
+                    return HugePages::HugePagesTransparent;
+                } else if (name == "explicit") {
+                    return HugePages::HugePagesExplicit;
+                }
+                throw std::runtime_error("Unknown huge page mode: " + name);
+            }
+
+            void setPlacement(NumaPolicy numa, HugePages hugePages, int threadNum) {
+                numaPolicy = numa;
+                hugePagesPolicy = hugePages;
+                placementThreadNum = threadNum;
+            }
+
+            void* largeAlloc(size_t size) {
+                if (size < HugePageSize) {
+                    void* ptr = alignedAlloc(size);
+                    std::memset(ptr, 0, size);
+                    return ptr;
+                }
+                size = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+                void* ptr = mapAligned(size);
+                if (numaPolicy == NumaPolicy::NumaInterleave) {
+                    interleave(ptr, size);
+                }
+                if (numaPolicy != NumaPolicy::NumaOff) {
+                    touchParallel(ptr, size, placementThreadNum);
+                }
+                return ptr;
+            }
+
+            void largeFree(void* ptr, size_t size) {
+                if (size < HugePageSize) {
+                    alignedFree(ptr);
+                } else {
+                    munmap(ptr, (size + HugePageSize - 1) / HugePageSize * HugePageSize);
+                }
+            }
+
+        }
+
+        namespace io {
+
+            RawFile::RawFile(char* buffer, size_t capacity) : buffer(buffer), capacity(capacity), size(0), fd(-1), failed(false) {}
+
+            RawFile::~RawFile() {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+            }
+
+            bool RawFile::open(const char* path) {
+                fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                size = 0;
+                failed = fd < 0;
+                return !failed;
+            }
+
+            void RawFile::flush() {
+                const char* data = buffer;
+                while (size > 0 && !failed) {
+                    ssize_t written = ::write(fd, data, size);
+                    if (written < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (written <= 0) {
+                        failed = true;
+                        break;
+                    }
+                    data += written;
+                    size -= written;
+                }
+                size = 0;
+            }
+
+            void RawFile::write(const void* data, size_t length) {
+                const char* bytes = (const char*)data;
+                while (length > 0) {
+                    if (size == capacity) {
+                        flush();
+                    }
+                    size_t n = std::min(length, capacity - size);
+                    std::memcpy(buffer + size, bytes, n);
+                    size += n;
+                    bytes += n;
+                    length -= n;
+                }
+            }
+
+            void RawFile::write(char c) {
+                write(&c, 1);
+            }
+
+            void RawFile::write(long value) {
+                char digits[24];
+                int n = 0;
+                unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+                do {
+                    digits[sizeof(digits) - 1 - n++] = '0' + magnitude % 10;
+                    magnitude /= 10;
+                } while (magnitude > 0);
+                if (value < 0) {
+                    digits[sizeof(digits) - 1 - n++] = '-';
+                }
+                write(digits + sizeof(digits) - n, n);
+            }
+
+            void RawFile::append(const char* path) {
+                int in = ::open(path, O_RDONLY);
+                if (in < 0) {
+                    failed = true;
+                    return;
+                }
+                while (!failed) {
+                    if (size == capacity) {
+                        flush();
+                    }
+                    ssize_t n = ::read(in, buffer + size, capacity - size);
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n < 0) {
+                        failed = true;
+                    }
+                    if (n <= 0) {
+                        break;
+                    }
+                    size += n;
+                }
+                ::close(in);
+            }
+
+            bool RawFile::close() {
+                flush();
+                if (fd >= 0 && ::close(fd) != 0) {
+                    failed = true;
                 }
-                return table;
+                fd = -1;
+                return !failed;
             }
 
         }
@@ -6,6 +6,12 @@
 #include <functional>
 #include <cctype>
 #include <sstream>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
 
 namespace sv4d {
 
@@ -75,27 +81,252 @@ namespace sv4d {
                 return s;
             }
 
+            // Non-owning view of characters, e.g. a token in a mapped file.
+            struct StringView {
+                const char* data;
+                size_t size;
+
+                StringView() : data(nullptr), size(0) {}
+                StringView(const char* data, size_t size) : data(data), size(size) {}
+                StringView(const std::string& s) : data(s.data()), size(s.size()) {}
+
+                bool empty() const { return size == 0; }
+                const char* end() const { return data + size; }
+                std::string str() const { return std::string(data, size); }
+
+                bool operator==(const StringView& other) const {
+                    return size == other.size && std::equal(data, data + size, other.data);
+                }
+                bool operator!=(const StringView& other) const { return !(*this == other); }
+            };
+
+            inline StringView trim(StringView s) {
+                const char* left = s.data;
+                const char* right = s.end();
+                while (left < right && std::isspace((unsigned char)*left)) {
+                    ++left;
+                }
+                while (left < right && std::isspace((unsigned char)right[-1])) {
+                    --right;
+                }
+                return StringView(left, right - left);
+            }
+
+            // Splits off the field before the next delimiter and advances s
+            // past it, as one std::getline(stream, field, delimiter) would.
+            inline StringView nextField(StringView& s, char delimiter) {
+                const char* end = std::find(s.data, s.end(), delimiter);
+                StringView field(s.data, end - s.data);
+                s = end == s.end() ? StringView(end, 0) : StringView(end + 1, s.end() - end - 1);
+                return field;
+            }
+
+            // FNV-1a
+            inline uint64_t hash(const StringView& s) {
+                uint64_t h = 14695981039346656037ULL;
+                for (size_t i = 0; i < s.size; ++i) {
+                    h = (h ^ (unsigned char)s.data[i]) * 1099511628211ULL;
+                }
+                return h;
+            }
+
+        }
+
+        namespace io {
+
+            // Raw binary fields, e.g. of checkpoints. Readers must know the
+            // layout; nothing is tagged.
+            template <class T>
+            inline void write(std::ostream& out, const T& value) {
+                out.write((const char*)&value, sizeof(T));
+            }
+
+            template <class T>
+            inline void read(std::istream& in, T& value) {
+                in.read((char*)&value, sizeof(T));
+            }
+
+            template <class T>
+            inline void writeVector(std::ostream& out, const std::vector<T>& values) {
+                write(out, (int64_t)values.size());
+                out.write((const char*)values.data(), values.size() * sizeof(T));
+            }
+
+            template <class T>
+            inline void readVector(std::istream& in, std::vector<T>& values) {
+                int64_t size = 0;
+                read(in, size);
+                if (!in || size < 0) {
+                    throw std::runtime_error("Truncated binary data");
+                }
+                values.resize(size);
+                in.read((char*)values.data(), size * sizeof(T));
+            }
+
+            inline void writeString(std::ostream& out, const std::string& s) {
+                write(out, (int64_t)s.size());
+                out.write(s.data(), s.size());
+            }
+
+            inline void readString(std::istream& in, std::string& s) {
+                int64_t size = 0;
+                read(in, size);
+                if (!in || size < 0) {
+                    throw std::runtime_error("Truncated binary data");
+                }
+                s.resize(size);
+                in.read(&s[0], size);
+            }
+
+            // File output through a caller-owned buffer with open(2) and
+            // write(2) only, for the child of a fork in a threaded process,
+            // which must not allocate or take locks. Errors are kept until
+            // close().
+            class RawFile {
+                public:
+                    RawFile(char* buffer, size_t capacity);
+                    ~RawFile();
+
+                    bool open(const char* path);
+                    void write(const void* data, size_t length);
+                    void write(char c);
+                    // decimal, as std::to_string
+                    void write(long value);
+                    // appends the contents of the file at path
+                    void append(const char* path);
+                    // false if anything failed since open()
+                    bool close();
+
+                private:
+                    char* buffer;
+                    size_t capacity;
+                    size_t size;
+                    int fd;
+                    bool failed;
+
+                    void flush();
+            };
+
         }
 
         namespace operation {
 
-            const int SigmoidTableSize = 1024;
-            const int MaxSigmoid = 8.0;
+            // sigmoid and log-sigmoid are read from tables over
+            // [-MaxSigmoid, MaxSigmoid] with linear interpolation between
+            // entries. setSigmoidTableSize() rebuilds them and must be called
+            // before training threads start.
+            const int DefaultSigmoidTableSize = 1024;
+            const float MaxSigmoid = 8.0f;
+
+            extern std::vector<float> sigmoidTable;
+            extern std::vector<float> logSigmoidTable;
+            extern float sigmoidTableScale;
 
-            std::vector<float> computeSigmoidTable();
+            void setSigmoidTableSize(int size);
 
-            const std::vector<float> sigmoidTable = computeSigmoidTable();
+            inline float lookupSigmoidTable(const std::vector<float>& table, float x) {
+                float position = (std::min(std::max(x, -MaxSigmoid), MaxSigmoid) + MaxSigmoid) * sigmoidTableScale;
+                int i = (int)position;
+                float t = position - i;
+                return table[i] + t * (table[i + 1] - table[i]);
+            }
 
             inline float sigmoid(float x) {
+                return lookupSigmoidTable(sigmoidTable, x);
+            }
+
+            // log(sigmoid(x)); approaches x below the table range and 0 above
+            inline float logSigmoid(float x) {
                 if (x < -MaxSigmoid) {
-                    return 0.0f;
-                } else if (x > MaxSigmoid) {
-                    return 1.0f;
-                } else {
-                    int i = int((x + MaxSigmoid) * SigmoidTableSize / MaxSigmoid / 2);
-                    return sigmoidTable[i];
+                    return x;
                 }
+                return lookupSigmoidTable(logSigmoidTable, x);
             }
+
+        }
+
+        namespace memory {
+
+            const size_t Alignment = 64;
+
+            const size_t HugePageSize = 2 << 20;
+
+            enum NumaPolicy {
+                NumaOff = 0,
+                NumaLocal = 1,
+                NumaInterleave = 2,
+            };
+
+            enum HugePages {
+                HugePagesOff = 0,
+                HugePagesTransparent = 1,
+                HugePagesExplicit = 2,
+            };
+
+            void* alignedAlloc(size_t size);
+            void alignedFree(void* ptr);
+
+            inline size_t alignedSize(size_t size) {
+                return (size + Alignment - 1) / Alignment * Alignment;
+            }
+
+            NumaPolicy parseNumaPolicy(const std::string& name);
+            HugePages parseHugePages(const std::string& name);
+
+            // Placement of the allocations made by largeAlloc. With a NUMA
+            // policy the pages are first touched by threadNum threads in
+            // parallel instead of by whichever thread writes them first.
+            void setPlacement(NumaPolicy numa, HugePages hugePages, int threadNum);
+
+            // Zero-filled memory for weight slabs and tables. Blocks of at
+            // least HugePageSize are mapped directly, aligned to HugePageSize
+            // and placed according to setPlacement; smaller ones come from
+            // alignedAlloc. size must be passed back to largeFree.
+            void* largeAlloc(size_t size);
+            void largeFree(void* ptr, size_t size);
+
+            // Allocator placing std::vector storage with largeAlloc. Elements
+            // are default-initialized, so resize() does not touch the pages
+            // again from the calling thread.
+            template <class T>
+            class LargeAllocator {
+                public:
+                    typedef T value_type;
+
+                    LargeAllocator() {}
+
+                    template <class U>
+                    LargeAllocator(const LargeAllocator<U>&) {}
+
+                    T* allocate(size_t n) {
+                        return (T*)largeAlloc(n * sizeof(T));
+                    }
+
+                    void deallocate(T* ptr, size_t n) {
+                        largeFree(ptr, n * sizeof(T));
+                    }
+
+                    template <class U>
+                    void construct(U* ptr) {
+                        ::new((void*)ptr) U;
+                    }
+
+                    template <class U, class... Args>
+                    void construct(U* ptr, Args&&... args) {
+                        ::new((void*)ptr) U(std::forward<Args>(args)...);
+                    }
+
+                    template <class U>
+                    bool operator==(const LargeAllocator<U>&) const {
+                        return true;
+                    }
+
+                    template <class U>
+                    bool operator!=(const LargeAllocator<U>&) const {
+                        return false;
+                    }
+            };
+
         }
 
     }
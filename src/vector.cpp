@@ -1,264 +1,313 @@
 #include "vector.hpp"
 
+#include "utils.hpp"
+#include "kernel.hpp"
 #include <vector>
 #include <random>
 #include <limits>
+#include <cstring>
+#include <utility>
+#include <cassert>
 
 namespace sv4d {
 
+    namespace {
+
+        float* allocateVectorData(int n) {
+            float* data = (float*)sv4d::utils::memory::alignedAlloc(sizeof(float) * (n > 0 ? n : 1));
+            std::memset(data, 0, sizeof(float) * (n > 0 ? n : 1));
+            return data;
+        }
+
+    }
+
+    VectorView::VectorView() : data(nullptr), col(0), precision(sv4d::kernel::Precision::Fp32) {}
+
+    VectorView::VectorView(float* data, int n) : data(data), col(n), precision(sv4d::kernel::Precision::Fp32) {}
+
+    VectorView::VectorView(void* data, int n, sv4d::kernel::Precision precision) : data((float*)data), col(n), precision(precision) {}
+
     Vector::Vector() : Vector(0) {}
 
-    Vector::Vector(int n) : data(n, 0.0), col(n) {}
+    Vector::Vector(int n) : VectorView(allocateVectorData(n), n) {}
+
+    Vector::Vector(const sv4d::Vector& vector) : Vector(static_cast<const sv4d::VectorView&>(vector)) {}
 
-    void Vector::setZero() {
-        for (float& x : data) {
-            x = 0.0f;
+    Vector::Vector(sv4d::Vector&& vector) : VectorView(vector.data, vector.col) {
+        vector.data = nullptr;
+        vector.col = 0;
+    }
+
+    Vector::Vector(const sv4d::VectorView& vector) : VectorView(allocateVectorData(vector.col), vector.col) {
+        assign(vector);
+    }
+
+    Vector::~Vector() {
+        sv4d::utils::memory::alignedFree(data);
+    }
+
+    sv4d::Vector& Vector::operator=(const sv4d::Vector& vector) {
+        if (this != &vector) {
+            sv4d::Vector copy(vector);
+            std::swap(data, copy.data);
+            std::swap(col, copy.col);
         }
+        return *this;
     }
 
-    void Vector::setRandomUniform(float min, float max) {
+    sv4d::Vector& Vector::operator=(sv4d::Vector&& vector) {
+        std::swap(data, vector.data);
+        std::swap(col, vector.col);
+        return *this;
+    }
+
+    void VectorView::setZero() {
+        std::memset(data, 0, (size_t)sv4d::kernel::precisionSize(precision) * col);
+    }
+
+    void VectorView::assign(const sv4d::VectorView& vector) {
+        sv4d::kernel::convert(data, precision, vector.data, vector.precision, col);
+    }
+
+    void VectorView::setRandomUniform(float min, float max) {
+        if (precision != sv4d::kernel::Precision::Fp32) {
+            // draw in fp32 and narrow
+            sv4d::Vector buffer(col);
+            buffer.setRandomUniform(min, max);
+            assign(buffer);
+            return;
+        }
         std::mt19937 mt(495);
         std::uniform_real_distribution<float> r(min, max);
-        for (float& x : data) {
-            x = r(mt);
+        for (int i = 0; i < col; ++i) {
+            data[i] = r(mt);
         }
     }
 
-    std::vector<float>& Vector::getData() {
+    float* VectorView::getData() {
+        assert(precision == sv4d::kernel::Precision::Fp32);
         return data;
     }
 
-    float Vector::sum() {
+    float VectorView::sum() const {
+        assert(precision == sv4d::kernel::Precision::Fp32);
         float sum = 0.0f;
-        for (float& x : data) {
-            sum += x;
+        for (int i = 0; i < col; ++i) {
+            sum += data[i];
         }
         return sum;
     }
 
-    sv4d::Vector Vector::sigmoid() {
+    sv4d::VectorView VectorView::slice(int offset, int n) const {
+        assert(precision == sv4d::kernel::Precision::Fp32);
+        return sv4d::VectorView(data + offset, n);
+    }
+
+    float VectorView::squaredNorm() const {
+        assert(precision == sv4d::kernel::Precision::Fp32);
+        return sv4d::kernel::dot(data, data, col);
+    }
+
+    sv4d::Vector VectorView::sigmoid() const {
         sv4d::Vector outputVector(col);
-        for (int i = 0; i < col; ++i) {
-            outputVector.data[i] = sv4d::utils::operation::sigmoid(data[i]);
-        }
+        sigmoid(outputVector);
         return outputVector;
     }
 
-    sv4d::Vector Vector::softmax(float temperature) {
+    sv4d::Vector VectorView::softmax(float temperature) const {
         sv4d::Vector outputVector(col);
-        if (col == 1) {
-            outputVector.data[0] = 1.0f;
-        } else {
-            float max = std::numeric_limits<float>::lowest();
-            for (int i = 0; i < col; ++i) {
-                float logit = data[i] / temperature;
-                outputVector.data[i] = logit;
-                max = std::max(max, logit);
-            }
-            float sum = 0.0f;
-            for (float& x : outputVector.data) {
-                x = std::exp(x - max);
-                sum += x;
-            }
-            for (float& x : outputVector.data) {
-                x /= sum;
-            }
-        }
+        softmax(temperature, outputVector);
         return outputVector;
     }
 
-    void Vector::fusedMultiplyAdd(const sv4d::Vector& vector, const float factor) {
+    void VectorView::sigmoid(sv4d::VectorView output) const {
+        assert(precision == sv4d::kernel::Precision::Fp32);
         for (int i = 0; i < col; ++i) {
-            data[i] += vector.data[i] * factor;
+            output.data[i] = sv4d::utils::operation::sigmoid(data[i]);
         }
     }
 
-    sv4d::Vector Vector::operator+(const sv4d::Vector& vector) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    void VectorView::softmax(float temperature, sv4d::VectorView output) const {
+        assert(precision == sv4d::kernel::Precision::Fp32);
+        sv4d::kernel::softmax(data, col, temperature, output.data, nullptr);
+    }
+
+    void VectorView::softmax(float temperature, sv4d::VectorView output, sv4d::VectorView unitOutput) const {
+        assert(precision == sv4d::kernel::Precision::Fp32);
+        sv4d::kernel::softmax(data, col, temperature, output.data, unitOutput.data);
+    }
+
+    void VectorView::fusedMultiplyAdd(const sv4d::VectorView& vector, const float factor) {
+        sv4d::kernel::axpyMixed(data, precision, vector.data, vector.precision, factor, col);
+    }
+
+    sv4d::Vector VectorView::operator+(const sv4d::VectorView& vector) const {
+        sv4d::Vector outputVector(*this);
         outputVector += vector;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator-(const sv4d::Vector& vector) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator-(const sv4d::VectorView& vector) const {
+        sv4d::Vector outputVector(*this);
         outputVector -= vector;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator*(const sv4d::Vector& vector) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator*(const sv4d::VectorView& vector) const {
+        sv4d::Vector outputVector(*this);
         outputVector *= vector;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator/(const sv4d::Vector& vector) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator/(const sv4d::VectorView& vector) const {
+        sv4d::Vector outputVector(*this);
         outputVector /= vector;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator+(const float value) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator+(const float value) const {
+        sv4d::Vector outputVector(*this);
         outputVector += value;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator-(const float value) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator-(const float value) const {
+        sv4d::Vector outputVector(*this);
         outputVector -= value;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator*(const float value) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator*(const float value) const {
+        sv4d::Vector outputVector(*this);
         outputVector *= value;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator/(const float value) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator/(const float value) const {
+        sv4d::Vector outputVector(*this);
         outputVector /= value;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator+(const int value) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator+(const int value) const {
+        sv4d::Vector outputVector(*this);
         outputVector += value;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator-(const int value) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator-(const int value) const {
+        sv4d::Vector outputVector(*this);
         outputVector -= value;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator*(const int value) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator*(const int value) const {
+        sv4d::Vector outputVector(*this);
         outputVector *= value;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator/(const int value) {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator/(const int value) const {
+        sv4d::Vector outputVector(*this);
         outputVector /= value;
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator+=(const sv4d::Vector& vector) {
-        for (int i = 0; i < col; ++i) {
-            data[i] += vector.data[i];
-        }
+    sv4d::VectorView& VectorView::operator+=(const sv4d::VectorView& vector) {
+        sv4d::kernel::axpyMixed(data, precision, vector.data, vector.precision, 1.0f, col);
         return *this;
     }
 
-    sv4d::Vector Vector::operator-=(const sv4d::Vector& vector) {
-        for (int i = 0; i < col; ++i) {
-            data[i] -= vector.data[i];
-        }
+    sv4d::VectorView& VectorView::operator-=(const sv4d::VectorView& vector) {
+        sv4d::kernel::axpyMixed(data, precision, vector.data, vector.precision, -1.0f, col);
         return *this;
     }
 
-    sv4d::Vector Vector::operator*=(const sv4d::Vector& vector) {
+    sv4d::VectorView& VectorView::operator*=(const sv4d::VectorView& vector) {
+        assert(precision == sv4d::kernel::Precision::Fp32 && vector.precision == sv4d::kernel::Precision::Fp32);
         for (int i = 0; i < col; ++i) {
             data[i] *= vector.data[i];
         }
         return *this;
     }
 
-    sv4d::Vector Vector::operator/=(const sv4d::Vector& vector) {
+    sv4d::VectorView& VectorView::operator/=(const sv4d::VectorView& vector) {
+        assert(precision == sv4d::kernel::Precision::Fp32 && vector.precision == sv4d::kernel::Precision::Fp32);
         for (int i = 0; i < col; ++i) {
             data[i] /= vector.data[i];
         }
         return *this;
     }
 
-    sv4d::Vector Vector::operator+=(const float value) {
+    sv4d::VectorView& VectorView::operator+=(const float value) {
+        assert(precision == sv4d::kernel::Precision::Fp32);
         for (int i = 0; i < col; ++i) {
             data[i] += value;
         }
         return *this;
     }
 
-    sv4d::Vector Vector::operator-=(const float value) {
+    sv4d::VectorView& VectorView::operator-=(const float value) {
+        assert(precision == sv4d::kernel::Precision::Fp32);
         for (int i = 0; i < col; ++i) {
             data[i] -= value;
         }
         return *this;
     }
 
-    sv4d::Vector Vector::operator*=(const float value) {
-        for (int i = 0; i < col; ++i) {
-            data[i] *= value;
-        }
+    sv4d::VectorView& VectorView::operator*=(const float value) {
+        assert(precision == sv4d::kernel::Precision::Fp32);
+        sv4d::kernel::scale(data, value, col);
         return *this;
     }
 
-    sv4d::Vector Vector::operator/=(const float value) {
-        for (int i = 0; i < col; ++i) {
-            data[i] /= value;
-        }
+    sv4d::VectorView& VectorView::operator/=(const float value) {
+        assert(precision == sv4d::kernel::Precision::Fp32);
+        sv4d::kernel::scale(data, 1.0f / value, col);
         return *this;
     }
 
-    sv4d::Vector Vector::operator+=(const int value) {
+    sv4d::VectorView& VectorView::operator+=(const int value) {
+        assert(precision == sv4d::kernel::Precision::Fp32);
         for (int i = 0; i < col; ++i) {
             data[i] += value;
         }
         return *this;
     }
 
-    sv4d::Vector Vector::operator-=(const int value) {
+    sv4d::VectorView& VectorView::operator-=(const int value) {
+        assert(precision == sv4d::kernel::Precision::Fp32);
         for (int i = 0; i < col; ++i) {
             data[i] -= value;
         }
         return *this;
     }
 
-    sv4d::Vector Vector::operator*=(const int value) {
-        for (int i = 0; i < col; ++i) {
-            data[i] *= value;
-        }
+    sv4d::VectorView& VectorView::operator*=(const int value) {
+        assert(precision == sv4d::kernel::Precision::Fp32);
+        sv4d::kernel::scale(data, (float)value, col);
         return *this;
     }
 
-    sv4d::Vector Vector::operator/=(const int value) {
-        for (int i = 0; i < col; ++i) {
-            data[i] /= value;
-        }
+    sv4d::VectorView& VectorView::operator/=(const int value) {
+        assert(precision == sv4d::kernel::Precision::Fp32);
+        sv4d::kernel::scale(data, 1.0f / value, col);
         return *this;
     }
 
-    sv4d::Vector Vector::operator+() {
-        sv4d::Vector outputVector(col);
-        outputVector += *this;
+    sv4d::Vector VectorView::operator+() const {
+        sv4d::Vector outputVector(*this);
         return outputVector;
     }
 
-    sv4d::Vector Vector::operator-() {
+    sv4d::Vector VectorView::operator-() const {
         sv4d::Vector outputVector(col);
         outputVector -= *this;
         return outputVector;
     }
 
-    float Vector::operator%(const sv4d::Vector& vector) {
-        float dot = 0.0;
-        for (int i = 0; i < col; ++i) {
-            dot += data[i] * vector.data[i];
-        }
-        return dot;
+    float VectorView::operator%(const sv4d::VectorView& vector) const {
+        return sv4d::kernel::dotMixed(data, precision, vector.data, vector.precision, col);
     }
 
 }
\ No newline at end of file
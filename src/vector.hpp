@@ -1,64 +1,102 @@
 #pragma once
 
 #include "utils.hpp"
+#include "kernel.hpp"
 #include <vector>
 #include <complex>
 #include <numeric>
+#include <cassert>
 
 namespace sv4d {
 
-    class Vector {
+    class Vector;
+
+    // Non-owning view over n contiguous floats. Compound assignment and the
+    // out-parameter variants of sigmoid/softmax never allocate; the binary
+    // operators return a freshly allocated Vector.
+    //
+    // Rows of a half precision Matrix are views whose data points at 16-bit
+    // storage. Such views support setZero, assign, setRandomUniform, dot,
+    // fusedMultiplyAdd and += / -= with another view; element access and the
+    // remaining arithmetic require fp32 and assert it.
+    class VectorView {
         public:
-            Vector();
-            Vector(int n);
+            VectorView();
+            VectorView(float* data, int n);
+            VectorView(void* data, int n, sv4d::kernel::Precision precision);
 
-            std::vector<float> data;
+            float* data;
             int col;
+            sv4d::kernel::Precision precision;
 
             void setZero();
+            void assign(const sv4d::VectorView& vector);
             void setRandomUniform(float min, float max);
-            std::vector<float>& getData();
+            float* getData();
 
-            float sum();
-            sv4d::Vector sigmoid();
-            sv4d::Vector softmax(float temperature);
-            void fusedMultiplyAdd(const sv4d::Vector& vector, const float factor);
+            sv4d::VectorView slice(int offset, int n) const;
+
+            float sum() const;
+            float squaredNorm() const;
+            sv4d::Vector sigmoid() const;
+            sv4d::Vector softmax(float temperature) const;
+            void sigmoid(sv4d::VectorView output) const;
+            void softmax(float temperature, sv4d::VectorView output) const;
+            void softmax(float temperature, sv4d::VectorView output, sv4d::VectorView unitOutput) const;
+            void fusedMultiplyAdd(const sv4d::VectorView& vector, const float factor);
 
             inline float& operator[](int idx) {
+                assert(precision == sv4d::kernel::Precision::Fp32);
                 return data[idx];
             }
 
             inline const float& operator[](int idx) const {
+                assert(precision == sv4d::kernel::Precision::Fp32);
                 return data[idx];
             }
 
-            sv4d::Vector operator+(const sv4d::Vector& vector);
-            sv4d::Vector operator-(const sv4d::Vector& vector);
-            sv4d::Vector operator*(const sv4d::Vector& vector);
-            sv4d::Vector operator/(const sv4d::Vector& vector);
-            sv4d::Vector operator+(const float value);
-            sv4d::Vector operator-(const float value);
-            sv4d::Vector operator*(const float value);
-            sv4d::Vector operator/(const float value);
-            sv4d::Vector operator+(const int value);
-            sv4d::Vector operator-(const int value);
-            sv4d::Vector operator*(const int value);
-            sv4d::Vector operator/(const int value);
-            sv4d::Vector operator+=(const sv4d::Vector& vector);
-            sv4d::Vector operator-=(const sv4d::Vector& vector);
-            sv4d::Vector operator*=(const sv4d::Vector& vector);
-            sv4d::Vector operator/=(const sv4d::Vector& vector);
-            sv4d::Vector operator+=(const float value);
-            sv4d::Vector operator-=(const float value);
-            sv4d::Vector operator*=(const float value);
-            sv4d::Vector operator/=(const float value);
-            sv4d::Vector operator+=(const int value);
-            sv4d::Vector operator-=(const int value);
-            sv4d::Vector operator*=(const int value);
-            sv4d::Vector operator/=(const int value);
-            sv4d::Vector operator+();
-            sv4d::Vector operator-();
-            float operator%(const sv4d::Vector& vector);
+            sv4d::Vector operator+(const sv4d::VectorView& vector) const;
+            sv4d::Vector operator-(const sv4d::VectorView& vector) const;
+            sv4d::Vector operator*(const sv4d::VectorView& vector) const;
+            sv4d::Vector operator/(const sv4d::VectorView& vector) const;
+            sv4d::Vector operator+(const float value) const;
+            sv4d::Vector operator-(const float value) const;
+            sv4d::Vector operator*(const float value) const;
+            sv4d::Vector operator/(const float value) const;
+            sv4d::Vector operator+(const int value) const;
+            sv4d::Vector operator-(const int value) const;
+            sv4d::Vector operator*(const int value) const;
+            sv4d::Vector operator/(const int value) const;
+            sv4d::VectorView& operator+=(const sv4d::VectorView& vector);
+            sv4d::VectorView& operator-=(const sv4d::VectorView& vector);
+            sv4d::VectorView& operator*=(const sv4d::VectorView& vector);
+            sv4d::VectorView& operator/=(const sv4d::VectorView& vector);
+            sv4d::VectorView& operator+=(const float value);
+            sv4d::VectorView& operator-=(const float value);
+            sv4d::VectorView& operator*=(const float value);
+            sv4d::VectorView& operator/=(const float value);
+            sv4d::VectorView& operator+=(const int value);
+            sv4d::VectorView& operator-=(const int value);
+            sv4d::VectorView& operator*=(const int value);
+            sv4d::VectorView& operator/=(const int value);
+            sv4d::Vector operator+() const;
+            sv4d::Vector operator-() const;
+            float operator%(const sv4d::VectorView& vector) const;
+    };
+
+    // Owning vector backed by an aligned buffer. Copies are deep; views of a
+    // Vector stay valid until it is destroyed or reassigned.
+    class Vector : public VectorView {
+        public:
+            Vector();
+            Vector(int n);
+            Vector(const sv4d::Vector& vector);
+            Vector(sv4d::Vector&& vector);
+            explicit Vector(const sv4d::VectorView& vector);
+            ~Vector();
+
+            sv4d::Vector& operator=(const sv4d::Vector& vector);
+            sv4d::Vector& operator=(sv4d::Vector&& vector);
     };
 
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 
 #include "options.hpp"
 #include "utils.hpp"
+#include "corpus.hpp"
 #include <unordered_map>
 #include <fstream>
 #include <algorithm>
@@ -47,39 +48,11 @@ namespace sv4d {
     void Vocab::build(const sv4d::Options& opt) {
         std::string linebuf;
 
-        auto wordStats = std::unordered_map<std::string, int>();
-        
-        std::ifstream corpusfin(opt.trainingCorpus);
-        if (corpusfin.fail()) {
-            throw std::runtime_error("Cannot open training corpus file");
-        }
-        while (std::getline(corpusfin, linebuf)) {
-            linebuf = sv4d::utils::string::trim(linebuf);
-            if (linebuf == "<doc>") {
-                totalDocumentNum += 1;
-                continue;
-            } else if (linebuf == "</doc>") {
-                continue;
-            } else if (linebuf == "") {
-                continue;
-            }
-
-            for (auto word : sv4d::utils::string::split(linebuf, ' ')) {
-                if (wordStats.find(word) == wordStats.end()) {
-                    wordStats[word] = 0;
-                }
-                ++wordStats[word];
-            }
-
-            totalSentenceNum += 1;
-            if (totalSentenceNum % 10000 == 0) {
-                printf("%cReading Line: %ldk  ", 13, totalSentenceNum / 1000);
-                fflush(stdout);
-            }
-        }
+        sv4d::CorpusStats stats = opt.compiledCorpus != "" ? sv4d::readCompiledCorpusStats(opt.compiledCorpus) : sv4d::countCorpusWords(opt.trainingCorpus);
+        totalSentenceNum = stats.sentenceNum;
+        totalDocumentNum = stats.documentNum;
 
-        auto sortedWordStats = std::vector<std::pair<std::string, int>>(wordStats.begin(), wordStats.end());
-        std::sort(sortedWordStats.begin(), sortedWordStats.end(), [](const std::pair<std::string, int> & a, const std::pair<std::string, int> & b) -> bool { return a.second > b.second; });
+        auto& sortedWordStats = stats.wordStats;
         for (auto& pair : sortedWordStats) {
             auto word = pair.first;
             int freq = pair.second;
@@ -230,6 +203,38 @@ namespace sv4d {
         printf("LemmaVocabSize: %d  SynsetVocabSize: %d  WordVocabSize: %d  \n", lemmaVocabSize, synsetVocabSize, wordVocabSize);
     }
 
+    sv4d::CompiledVocab Vocab::compile() const {
+        sv4d::CompiledVocab compiled;
+        compiled.maxSenseNum = 1;
+        compiled.senseOffsets.push_back(0);
+        compiled.validPosOffsets.push_back(0);
+        for (auto& synsetData : widx2lidxs) {
+            for (int pos = 0; pos < 4; ++pos) {
+                for (int lidx : synsetData.synsetLemmaIndices[pos]) {
+                    compiled.senseLemmas.push_back(lidx);
+                    compiled.senseSynsets.push_back(lidx2sidx[lidx]);
+                }
+                compiled.senseOffsets.push_back(compiled.senseLemmas.size());
+            }
+            for (int pos : synsetData.validPos) {
+                compiled.validPos.push_back(pos);
+                compiled.maxSenseNum = std::max(compiled.maxSenseNum, (int)synsetData.synsetLemmaIndices[pos].size());
+            }
+            compiled.validPosOffsets.push_back(compiled.validPos.size());
+            compiled.wordSynsets.push_back(lidx2sidx[synsetData.wordLemmaIndex]);
+        }
+
+        compiled.dictPairOffsets.push_back(0);
+        for (int sidx = 0; sidx < synsetVocabSize; ++sidx) {
+            auto it = synsetDictPair.find(sidx);
+            if (it != synsetDictPair.end()) {
+                compiled.dictPairs.insert(compiled.dictPairs.end(), it->second.dictPair.begin(), it->second.dictPair.end());
+            }
+            compiled.dictPairOffsets.push_back(compiled.dictPairs.size());
+        }
+        return compiled;
+    }
+
     void Vocab::save(const std::string& filepath) {
         std::ofstream fout(filepath);
         if (fout.fail()) {
@@ -293,9 +298,9 @@ namespace sv4d {
 
         std::getline(fin, linebuf);
         auto nums = sv4d::utils::string::split(sv4d::utils::string::trim(linebuf), ' ');
-        totalWordsNum = std::stoi(nums[0]);
-        totalSentenceNum = std::stoi(nums[1]);
-        totalDocumentNum = std::stoi(nums[2]);
+        totalWordsNum = std::stol(nums[0]);
+        totalSentenceNum = std::stol(nums[1]);
+        totalDocumentNum = std::stol(nums[2]);
 
         while (std::getline(fin, linebuf)) {
             linebuf = sv4d::utils::string::trim(linebuf);
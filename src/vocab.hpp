@@ -29,6 +29,33 @@ namespace sv4d {
         std::vector<int> dictPair;
     };
 
+    // Immutable flat copy of the sense inventory and the dictionary pairs
+    // read by the training loop, built by Vocab::compile(). Ranges are CSR:
+    // the lemmas of word widx with part of speech pos are
+    // senseLemmas[senseOffsets[widx * 4 + pos] .. senseOffsets[widx * 4 + pos + 1])
+    // and the dictionary pairs of synset sidx are
+    // dictPairs[dictPairOffsets[sidx] .. dictPairOffsets[sidx + 1]).
+    struct CompiledVocab {
+        std::vector<int> senseOffsets;
+        std::vector<int> senseLemmas;
+        // lidx2sidx of senseLemmas
+        std::vector<int> senseSynsets;
+        std::vector<int> validPosOffsets;
+        std::vector<int> validPos;
+        // synset index of each word's own lemma
+        std::vector<int> wordSynsets;
+        std::vector<int> dictPairOffsets;
+        std::vector<int> dictPairs;
+        int maxSenseNum;
+
+        int senseBegin(int widx, int pos) const { return senseOffsets[widx * 4 + pos]; }
+        int senseNum(int widx, int pos) const { return senseOffsets[widx * 4 + pos + 1] - senseOffsets[widx * 4 + pos]; }
+        int validPosNum(int widx) const { return validPosOffsets[widx + 1] - validPosOffsets[widx]; }
+        int validPosAt(int widx, int i) const { return validPos[validPosOffsets[widx] + i]; }
+        const int* dictPairBegin(int sidx) const { return dictPairs.data() + dictPairOffsets[sidx]; }
+        int dictPairNum(int sidx) const { return dictPairOffsets[sidx + 1] - dictPairOffsets[sidx]; }
+    };
+
     class Vocab {
         public:
             Vocab();
@@ -55,6 +82,7 @@ namespace sv4d {
             std::unordered_map<int, sv4d::SynsetDictPair> synsetDictPair;
 
             void build(const sv4d::Options& opt);
+            sv4d::CompiledVocab compile() const;
             void save(const std::string& filepath);
             void load(const std::string& filepath);
     };
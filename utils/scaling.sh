@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# Training throughput over thread counts, with the shared output rows and
+# with per-thread hot rows. Extra arguments are passed to every run.
+
+if [ $# -lt 3 ]; then
+  echo "usage: scaling.sh <training_corpus> <synset_data_file> <model_dir> [training options]" 1>&2
+  echo "  THREADS (\"1 2 4 8 16 24 32\"), HOT_ROWS (4096) and HOT_ROW_SYNC (256) can be set in the environment" 1>&2
+  exit 1
+fi
+
+corpus=$1
+synset=$2
+model=$3
+shift 3
+
+threads=${THREADS:-"1 2 4 8 16 24 32"}
+hot_rows=${HOT_ROWS:-4096}
+hot_row_sync=${HOT_ROW_SYNC:-256}
+
+mkdir -p $model
+
+printf "%8s  %20s  %20s  %8s\n" "threads" "words/sec (shared)" "words/sec (hot rows)" "speedup"
+for t in $threads; do
+  for hot in 0 $hot_rows; do
+    # the last progress line holds the mean speed of the whole run
+    ../bin/sv4d training -training_corpus $corpus -synset_data_file $synset -model_dir $model -thread_num $t -hot_rows $hot -hot_row_sync $hot_row_sync "$@" > $model/scaling.log 2>&1 || { echo "training failed, see $model/scaling.log" 1>&2; exit 1; }
+    speed=$(tr '\r' '\n' < $model/scaling.log | grep -o "Words/thread/sec: [0-9.]*" | tail -1 | awk '{ print $2 }')
+    if [ $hot -eq 0 ]; then
+      shared=$(awk -v s=$speed -v t=$t 'BEGIN { printf "%.0f", s * t * 1000 }')
+    else
+      private=$(awk -v s=$speed -v t=$t 'BEGIN { printf "%.0f", s * t * 1000 }')
+    fi
+  done
+  printf "%8d  %20d  %20d  %7.2fx\n" $t $shared $private $(awk -v a=$private -v b=$shared 'BEGIN { print a / b }')
+done